@@ -0,0 +1,161 @@
+#ifndef ACCOUNTING_H
+#define ACCOUNTING_H
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define ACCOUNT_TOP 5 /* rows in each table of summary, only these are kept */
+
+/*
+  Get current time of monotonic clock in seconds.
+*/
+double monotonicSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Resources used by one command line, all its processes together */
+struct CommandUsage {
+  std::string command;  // input line
+  double real;          // wall time in seconds
+  double user;          // user CPU time in seconds
+  double sys;           // system CPU time in seconds
+  long maxrss;          // max resident set size in KB, of the biggest process
+  long voluntary;       // voluntary context switches, like waiting for input
+  long involuntary;     // involuntary context switches, time slice used up
+
+  CommandUsage(const std::string & curt_command, double curt_real) :
+      command(curt_command),
+      real(curt_real),
+      user(0),
+      sys(0),
+      maxrss(0),
+      voluntary(0),
+      involuntary(0) {}
+
+  /*
+    Add resources of one process got from wait4() or getrusage().
+  */
+  void add(const struct rusage & usage) {
+    user += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    sys += usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    maxrss = std::max(maxrss, (long)usage.ru_maxrss);
+    voluntary += usage.ru_nvcsw;
+    involuntary += usage.ru_nivcsw;
+  }
+};
+
+/* Class for resources used by commands of this session, for "time" and accounting mode */
+class UsageLog
+{
+ private:
+  std::vector<CommandUsage> slowest;  // heap of ACCOUNT_TOP slowest commands, fastest on top
+  std::vector<CommandUsage> biggest;  // heap of ACCOUNT_TOP biggest maxrss, smallest on top
+  size_t measured;                    // how many commands were measured
+  bool accounting;                    // whether every command is measured, not only "time"
+
+ public:
+  UsageLog() : slowest(), biggest(), measured(0), accounting(false) {}
+
+  bool accountingOn() const { return accounting; }
+  void setAccounting(bool on) { accounting = on; }
+
+  /*
+    Keep resources of a finished command, print them at once if it was run with "time".
+    Only the top of each summary table is kept, so a long session uses no more memory.
+    maxrss of 0 means it's unknown, like for a built-in instruction run in shell itself.
+  */
+  void record(const CommandUsage & usage, bool timed) {
+    if (timed) {
+      std::ostringstream line;
+      line << std::fixed << std::setprecision(3) << "real " << usage.real << "s  user "
+           << usage.user << "s  sys " << usage.sys << "s  maxrss " << memory(usage, "KB")
+           << "  switches " << usage.voluntary << "+" << usage.involuntary << "\n";
+      std::cout.flush();
+      std::cerr << line.str();
+    }
+    if (timed || accounting) {
+      measured++;
+      keep(slowest, usage, slower);
+      keep(biggest, usage, bigger);
+    }
+  }
+
+  /*
+    Print table of slowest commands and commands using most memory, ACCOUNT_TOP of each.
+  */
+  void summary(std::ostream & out) {
+    if (measured == 0) {
+      out << "account: no command measured\n";
+      return;
+    }
+    out << "Slowest commands of " << measured << " measured:\n";
+    printTable(out, slowest, slower);
+    out << "Commands using most memory:\n";
+    printTable(out, biggest, bigger);
+  }
+
+ private:
+  static bool slower(const CommandUsage & a, const CommandUsage & b) { return a.real > b.real; }
+  static bool bigger(const CommandUsage & a, const CommandUsage & b) { return a.maxrss > b.maxrss; }
+
+  /*
+    Get maxrss to print followed by unit, "-" when it's unknown.
+  */
+  static std::string memory(const CommandUsage & usage, const char * unit) {
+    return usage.maxrss == 0 ? "-" : std::to_string(usage.maxrss) + unit;
+  }
+
+  /*
+    Helper function to put usage in heap of top ACCOUNT_TOP by first, if it's among them.
+    Heap is ordered by first, so the one that falls out first is on top.
+  */
+  void keep(std::vector<CommandUsage> & heap,
+            const CommandUsage & usage,
+            bool (*first)(const CommandUsage &, const CommandUsage &)) {
+    if (heap.size() < ACCOUNT_TOP) {
+      heap.push_back(usage);
+      std::push_heap(heap.begin(), heap.end(), first);
+    }
+    else if (first(usage, heap.front())) {
+      std::pop_heap(heap.begin(), heap.end(), first);
+      heap.back() = usage;
+      std::push_heap(heap.begin(), heap.end(), first);
+    }
+  }
+
+  /*
+    Print rows of heap in order by first, with a header line.
+  */
+  void printTable(std::ostream & out,
+                  const std::vector<CommandUsage> & heap,
+                  bool (*first)(const CommandUsage &, const CommandUsage &)) {
+    std::vector<CommandUsage> rows(heap);
+    std::sort_heap(rows.begin(), rows.end(), first);
+    out << std::right << std::setw(10) << "real(s)" << std::setw(10) << "user(s)" << std::setw(10)
+        << "sys(s)" << std::setw(12) << "maxrss(KB)" << std::setw(12) << "switches"
+        << "  command\n";
+    out << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < rows.size(); i++) {
+      CommandUsage & usage = rows[i];
+      std::string switches =
+          std::to_string(usage.voluntary) + "+" + std::to_string(usage.involuntary);
+      out << std::setw(10) << usage.real << std::setw(10) << usage.user << std::setw(10)
+          << usage.sys << std::setw(12) << memory(usage, "") << std::setw(12) << switches << "  "
+          << usage.command << "\n";
+    }
+    out.unsetf(std::ios::floatfield);
+    out << std::setprecision(6);
+  }
+};
+
+#endif
@@ -0,0 +1,277 @@
+#include <time.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../lexer.h"
+
+/*
+  Get current time of monotonic clock in microseconds.
+*/
+double nowMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+  Old way of handling a line, kept here to compare with: split by '|', replace variables,
+  prune '\' and cut into words, each step copying the line again.
+*/
+std::vector<std::string> legacySplit(std::string & input) {
+  std::vector<std::string> stages;
+  size_t start = 0;
+  for (size_t i = 0; i < input.size(); i++) {
+    if (input[i] == '\\') {
+      i++;
+    }
+    else if (input[i] == '|') {
+      stages.push_back(input.substr(start, i - start));
+      start = i + 1;
+    }
+  }
+  stages.push_back(input.substr(start));
+  return stages;
+}
+
+std::string legacyVariables(std::string input,
+                            std::unordered_map<std::string, std::string> & vars) {
+  std::string answer;
+  for (size_t i = 0; i < input.size(); i++) {
+    if (input[i] != '$') {
+      answer += input[i];
+    }
+    else {
+      size_t start = i + 1;
+      size_t curt = i + 1;
+      size_t match_position = i;
+      std::string temp;
+      while (curt <= input.size() && determineRange(input[curt])) {
+        std::string curtcut = input.substr(start, curt - start + 1);
+        if (vars.find(curtcut) != vars.end()) {
+          temp = vars[curtcut];
+          match_position = curt;
+        }
+        curt++;
+      }
+      answer += temp;
+      i = match_position;
+    }
+  }
+  return answer;
+}
+
+std::string legacyPrune(std::string input, std::unordered_map<std::string, std::string> & vars) {
+  input = legacyVariables(input, vars);
+  std::string answer;
+  bool first_space = true;
+  bool second_space = true;
+  for (size_t i = 0; i < input.size(); i++) {
+    if (first_space && second_space) {
+      if (input[i] != ' ') {
+        first_space = false;
+        if (input[i] != '\\')
+          answer += input[i];
+      }
+    }
+    else if (second_space) {
+      if (input[i] == ' ') {
+        second_space = false;
+      }
+      if (input[i] != '\\')
+        answer += input[i];
+    }
+    else {
+      if (input[i] != '\\') {
+        answer += input[i];
+      }
+      else {
+        if (i + 1 < input.size() && input[i + 1] == ' ') {
+          answer += input[i];
+          answer += input[i + 1];
+          i++;
+        }
+      }
+    }
+  }
+  return answer;
+}
+
+std::vector<std::string> legacyWords(std::string input) {
+  std::vector<std::string> words;
+  std::string word;
+  bool inword = false;
+  for (size_t i = 0; i < input.size(); i++) {
+    if (input[i] != ' ') {
+      if (input[i] == '\\') {
+        word += ' ';
+        i++;
+      }
+      else {
+        word += input[i];
+      }
+      inword = true;
+    }
+    else if (inword) {
+      words.push_back(word);
+      word.clear();
+      inword = false;
+    }
+  }
+  if (inword) {
+    words.push_back(word);
+  }
+  return words;
+}
+
+/*
+  Handle line the old way, return number of words so work is not optimized away.
+*/
+size_t legacyLine(std::string line, std::unordered_map<std::string, std::string> & vars) {
+  size_t count = 0;
+  std::vector<std::string> stages = legacySplit(line);
+  for (size_t i = 0; i < stages.size(); i++) {
+    std::string pruned = legacyPrune(stages[i], vars);
+    count += legacyWords(pruned).size();
+  }
+  return count;
+}
+
+/*
+  Check lexer gives the same words as old way for many random lines.
+*/
+bool checkSame(std::unordered_map<std::string, std::string> & vars, VarTable & table, int lines) {
+  const char alphabet[] = "  ab$\\|x_1";
+  Lexer lexer;
+  srand(551);
+  for (int n = 0; n < lines; n++) {
+    std::string line;
+    size_t length = rand() % 24;
+    for (size_t k = 0; k < length; k++) {
+      line += alphabet[rand() % (sizeof(alphabet) - 1)];
+    }
+
+    std::vector<LexedCommand> & commands = lexer.lex(line, table);
+    std::string copy(line);
+    std::vector<std::string> stages = legacySplit(copy);
+    if (stages.size() != commands.size()) {
+      std::cerr << "different stages for [" << line << "]\n";
+      return false;
+    }
+    for (size_t i = 0; i < stages.size(); i++) {
+      if (commands[i].blank) {
+        continue;
+      }
+      std::string pruned = legacyPrune(stages[i], vars);
+      std::vector<std::string> words = legacyWords(pruned);
+      bool same = pruned == commands[i].text && words.size() == commands[i].count;
+      for (size_t w = 0; same && w < words.size(); w++) {
+        same = words[w] == commands[i].args[w];
+      }
+      if (!same) {
+        std::cerr << "different words for [" << line << "]\n";
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/*
+  Time old way and lexer on the same line, print microseconds per line of each.
+*/
+void measure(const char * name,
+             const std::string & line,
+             std::unordered_map<std::string, std::string> & vars,
+             VarTable & table,
+             int times) {
+  size_t words = 0;
+  double start = nowMicros();
+  for (int i = 0; i < times; i++) {
+    words += legacyLine(line, vars);
+  }
+  double legacy_us = (nowMicros() - start) / times;
+
+  Lexer lexer;
+  start = nowMicros();
+  for (int i = 0; i < times; i++) {
+    std::vector<LexedCommand> & commands = lexer.lex(line, table);
+    for (size_t k = 0; k < commands.size(); k++) {
+      words -= commands[k].count;
+    }
+  }
+  double lexer_us = (nowMicros() - start) / times;
+
+  std::cout << name << " (" << line.size() << " chars):\n";
+  std::cout << "  old:   " << legacy_us << " us/line\n";
+  std::cout << "  lexer: " << lexer_us << " us/line\n";
+  if (words != 0) {
+    std::cerr << "word count differs\n";
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*
+  Compare old line handling with single pass lexer.
+  Usage: lexbench [times]
+*/
+int main(int argc, char ** argv) {
+  int times = argc > 1 ? atoi(argv[1]) : 200;
+  if (times <= 0) {
+    std::cerr << "usage: lexbench [times]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // same variables in old map and in table used by lexer
+  std::unordered_map<std::string, std::string> vars;
+  VarTable table;
+  vars["a"] = "1";
+  vars["ab"] = "x y";
+  vars["b"] = "\\ q";
+  vars["x"] = "|";
+  vars["x_1"] = "$a";
+  for (std::unordered_map<std::string, std::string>::iterator it = vars.begin(); it != vars.end();
+       ++it) {
+    table.set(it->first, it->second);
+  }
+  if (!checkSame(vars, table, 200000)) {
+    return EXIT_FAILURE;
+  }
+  std::cout << "lexer gives same words as old way\n";
+
+  // "${name}" is new, it never guesses
+  Lexer lexer;
+  std::vector<LexedCommand> & braced = lexer.lex("echo ${a}b ${ab}c ${abc}d ${b", table);
+  if (std::string(braced[0].text) != "echo 1b x yc d {b") {
+    std::cerr << "wrong ${name}: " << braced[0].text << "\n";
+    return EXIT_FAILURE;
+  }
+
+  // a very long line of plain words
+  std::string long_line("echo");
+  for (int i = 0; i < 20000; i++) {
+    long_line += " word\\ " + std::to_string(i);
+  }
+  measure("long line", long_line, vars, table, times);
+
+  // a line using long variable names, with hundreds of variables set
+  std::string name(40, 'v');
+  for (int i = 0; i < 500; i++) {
+    std::string other = "var_" + std::to_string(i);
+    vars[other] = "other";
+    table.set(other, "other");
+  }
+  vars[name] = "value";
+  table.set(name, "value");
+  std::string var_line("echo");
+  for (int i = 0; i < 2000; i++) {
+    var_line += " $" + name + " $" + name + "_" + std::to_string(i);
+  }
+  measure("many variables", var_line, vars, table, times);
+
+  return EXIT_SUCCESS;
+}
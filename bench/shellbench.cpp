@@ -0,0 +1,234 @@
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern char ** environ;
+
+/* Language a script is written in, myShell has its own built-in instructions */
+enum Dialect { MYSHELL, POSIX };
+
+/* Shell to measure */
+struct Shell {
+  std::string name;  // shown in report
+  std::string path;  // program run with script as its argument
+  Dialect dialect;   // how scripts are written for it
+};
+
+/* One kind of input, made into a script of the dialect of each shell */
+struct Workload {
+  std::string name;            // shown in report
+  int lines;                   // lines in script
+  std::string path_prefix;     // directories put before PATH, may be empty
+  int env_vars;                // extra environment variables given to shell
+  std::string (*line)(Dialect dialect, int i);  // line i of script
+};
+
+/*
+  Get current time of monotonic clock in microseconds.
+*/
+double nowMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+std::string emptyLine(Dialect, int) {
+  return "";
+}
+
+std::string builtinLine(Dialect dialect, int i) {
+  const char * myshell[] = {"set v 1", "inc v", "export v"};
+  const char * posix[] = {"v=1", "v=$((v+1))", "export v"};
+  return dialect == MYSHELL ? myshell[i % 3] : posix[i % 3];
+}
+
+std::string trueLine(Dialect, int) {
+  return "/bin/true";
+}
+
+std::string lookupLine(Dialect, int) {
+  return "uname";
+}
+
+/*
+  First lines set 50 variables, the rest use all of them in one long line.
+*/
+std::string variableLine(Dialect dialect, int i) {
+  const int vars = 50;
+  if (i < vars) {
+    std::string name = "variable_" + std::to_string(i);
+    return dialect == MYSHELL ? "set " + name + " value" : name + "=value";
+  }
+  std::string line = dialect == MYSHELL ? "set x " : "x=";
+  for (int k = 0; k < vars; k++) {
+    line += "${variable_" + std::to_string(k) + "}";
+  }
+  return line;
+}
+
+/*
+  Sort samples and get the one at fraction of them.
+*/
+double percentile(std::vector<double> samples, double fraction) {
+  std::sort(samples.begin(), samples.end());
+  size_t index = std::min(samples.size() - 1, (size_t)(fraction * samples.size()));
+  return samples[index];
+}
+
+/*
+  Run shell on script once with output thrown away, return microseconds it took.
+*/
+double runOnce(const Shell & shell, const std::string & script, std::vector<char *> & envp) {
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+  std::vector<char *> argv;
+  argv.push_back(const_cast<char *>(shell.path.c_str()));
+  argv.push_back(const_cast<char *>(script.c_str()));
+  argv.push_back(nullptr);
+
+  double start = nowMicros();
+  pid_t pid;
+  int error = posix_spawn(&pid, shell.path.c_str(), &actions, nullptr, &argv[0], &envp[0]);
+  posix_spawn_file_actions_destroy(&actions);
+  if (error != 0) {
+    std::cerr << shell.path << ": " << std::strerror(error) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  int wstatus;
+  waitpid(pid, &wstatus, 0);
+  return nowMicros() - start;
+}
+
+/*
+  Write script of workload in dialect to path.
+*/
+void writeScript(const std::string & path, const Workload & work, Dialect dialect, int lines) {
+  std::ofstream out(path.c_str(), std::ios::trunc);
+  for (int i = 0; i < lines; i++) {
+    out << work.line(dialect, i) << "\n";
+  }
+}
+
+/*
+  Environment of shell for workload: ours with PATH changed and extra variables added.
+*/
+std::vector<std::string> makeEnvironment(const Workload & work) {
+  std::vector<std::string> env;
+  for (char ** e = environ; *e != nullptr; e++) {
+    if (std::strncmp(*e, "PATH=", 5) != 0) {
+      env.push_back(*e);
+    }
+  }
+  const char * path = getenv("PATH");
+  env.push_back("PATH=" + work.path_prefix + (path == nullptr ? "/usr/bin:/bin" : path));
+  for (int i = 0; i < work.env_vars; i++) {
+    env.push_back("BENCH_VARIABLE_" + std::to_string(i) + "=" + std::string(100, 'x'));
+  }
+  return env;
+}
+
+/*
+  Measure shell on workload, print lines per second and time per line over several runs.
+  Time of starting a shell on an empty script is taken off, so only lines are counted.
+*/
+void measure(const Shell & shell, const Workload & work, const std::string & script, int runs) {
+  std::vector<std::string> env = makeEnvironment(work);
+  std::vector<char *> envp;
+  for (size_t i = 0; i < env.size(); i++) {
+    envp.push_back(&env[i][0]);
+  }
+  envp.push_back(nullptr);
+
+  std::vector<double> startup;
+  writeScript(script, work, shell.dialect, 0);
+  for (int i = 0; i < runs; i++) {
+    startup.push_back(runOnce(shell, script, envp));
+  }
+  double startup_us = percentile(startup, 0.5);
+
+  std::vector<double> per_line;
+  writeScript(script, work, shell.dialect, work.lines);
+  for (int i = 0; i < runs; i++) {
+    double spent = runOnce(shell, script, envp) - startup_us;
+    per_line.push_back(std::max(spent, 0.0) / work.lines);
+  }
+
+  double p50 = percentile(per_line, 0.5);
+  std::cout << std::left << std::setw(14) << work.name << std::setw(10) << shell.name << std::right
+            << std::fixed << std::setprecision(0) << std::setw(12) << (p50 > 0 ? 1e6 / p50 : 0)
+            << std::setprecision(2) << std::setw(10) << p50 << std::setw(10)
+            << percentile(per_line, 0.9) << std::setw(10) << percentile(per_line, 0.99)
+            << std::setprecision(0) << std::setw(12) << startup_us << "\n";
+}
+
+/*
+  Measure time per line of myShell against /bin/sh and bash on generated workloads.
+  Usage: shellbench [myShell] [runs]
+*/
+int main(int argc, char ** argv) {
+  std::string myshell = argc > 1 ? argv[1] : "./myShell";
+  int runs = argc > 2 ? atoi(argv[2]) : 20;
+  if (runs <= 0) {
+    std::cerr << "usage: shellbench [myShell] [runs]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<Shell> shells;
+  shells.push_back(Shell{"myShell", myshell, MYSHELL});
+  const char * others[] = {"/bin/sh", "/bin/bash"};
+  for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); i++) {
+    if (access(others[i], X_OK) == 0) {
+      shells.push_back(Shell{std::string(others[i]).substr(5), others[i], POSIX});
+    }
+  }
+
+  // 300 directories that don't exist before real PATH
+  std::string deep_path;
+  for (int i = 0; i < 300; i++) {
+    deep_path += "/nonexistent/shellbench/" + std::to_string(i) + ":";
+  }
+
+  std::vector<Workload> workloads;
+  workloads.push_back(Workload{"empty", 20000, "", 0, emptyLine});
+  workloads.push_back(Workload{"builtins", 20000, "", 0, builtinLine});
+  workloads.push_back(Workload{"true", 500, "", 0, trueLine});
+  workloads.push_back(Workload{"deep PATH", 500, deep_path, 0, lookupLine});
+  workloads.push_back(Workload{"variables", 2000, "", 0, variableLine});
+  workloads.push_back(Workload{"large env", 500, "", 5000, trueLine});
+
+  char script[] = "/tmp/shellbench.XXXXXX";
+  int fd = mkstemp(script);
+  if (fd == -1) {
+    std::cerr << "mkstemp: " << std::strerror(errno) << std::endl;
+    return EXIT_FAILURE;
+  }
+  close(fd);
+
+  std::cout << runs << " runs of each, time to start shell is taken off\n";
+  std::cout << std::left << std::setw(14) << "workload" << std::setw(10) << "shell" << std::right
+            << std::setw(12) << "lines/s" << std::setw(10) << "p50 us" << std::setw(10) << "p90 us"
+            << std::setw(10) << "p99 us" << std::setw(12) << "start us" << "\n";
+  for (size_t w = 0; w < workloads.size(); w++) {
+    for (size_t s = 0; s < shells.size(); s++) {
+      measure(shells[s], workloads[w], script, runs);
+    }
+  }
+
+  unlink(script);
+  return EXIT_SUCCESS;
+}
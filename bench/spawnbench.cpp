@@ -0,0 +1,81 @@
+#include <sys/wait.h>
+#include <time.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "../launch.h"
+
+extern char ** environ;
+
+/*
+  Get current time of monotonic clock in microseconds.
+*/
+double nowMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+  Launch program given times with mode and wait for each, return average microseconds per command.
+*/
+double measure(LaunchSpec & spec, LaunchMode mode, int times) {
+  double start = nowMicros();
+  for (int i = 0; i < times; i++) {
+    pid_t pid = launchProgram(spec, mode);
+    if (pid == -1) {
+      std::cerr << spec.path << ": " << std::strerror(errno) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+  }
+  return (nowMicros() - start) / times;
+}
+
+/*
+  Compare latency per command of spawn, fork and fork server launch modes.
+  Usage: spawnbench [times] [MB of memory parent holds] [program]
+*/
+int main(int argc, char ** argv) {
+  int times = argc > 1 ? atoi(argv[1]) : 2000;
+  size_t megabytes = argc > 2 ? atoi(argv[2]) : 0;
+  const char * program = argc > 3 ? argv[3] : "/bin/true";
+
+  if (times <= 0) {
+    std::cerr << "usage: spawnbench [times] [MB] [program]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // fork server starts before parent grows, like the shell does
+  if (!fork_server.start()) {
+    std::cerr << "fork server: " << std::strerror(errno) << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // touch memory so parent has a big address space, like a long running shell
+  std::vector<char> ballast(megabytes * 1024 * 1024);
+  for (size_t i = 0; i < ballast.size(); i += 4096) {
+    ballast[i] = 1;
+  }
+
+  LaunchSpec spec;
+  spec.path = program;
+  spec.args.push_back(&spec.path[0]);
+  spec.args.push_back(nullptr);
+  spec.envp = environ;
+
+  double spawn_us = measure(spec, LAUNCH_SPAWN, times);
+  double fork_us = measure(spec, LAUNCH_FORK, times);
+  double server_us = measure(spec, LAUNCH_SERVER, times);
+
+  std::cout << program << ", " << times << " runs, parent holds " << megabytes << " MB\n";
+  std::cout << "spawn: " << spawn_us << " us/command\n";
+  std::cout << "fork:  " << fork_us << " us/command\n";
+  std::cout << "server: " << server_us << " us/command\n";
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,381 @@
+#ifndef COMMANDCACHE_H
+#define COMMANDCACHE_H
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// changes of a PATH directory that add or remove commands, a mode change may make a file one
+#define CACHE_WATCH_EVENTS                                                                       \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/*
+  Class for command lookup table, like bash's 'hash'.
+  Directories of PATH are watched with inotify, so a created or removed program changes only
+  its own entry, and a command costs one read() of pending events instead of a stat() of every
+  directory. Directories that cannot be watched are checked by modification time. A relative
+  directory like "." or "bin" is never watched, it's another directory after cd, so the table is
+  rebuilt when working directory changes.
+*/
+class CommandCache
+{
+ private:
+  /* One directory listed in PATH */
+  struct PathDir {
+    std::string name;       // directory name with '/' at the end
+    bool exists;            // whether directory could be stat()
+    struct timespec mtime;  // modification time when it was scanned
+    int watch;              // inotify watch of directory, -1 when it's checked with stat()
+  };
+
+  /* One command found in PATH */
+  struct Entry {
+    std::string path;  // absolute path of command
+    unsigned hits;     // how many times it was looked up to run
+    size_t dir;        // index in dirs of directory it was found in
+  };
+
+  std::string path_value;                        // PATH value the table was built from
+  std::vector<PathDir> dirs;                     // all directories of PATH, in order
+  std::unordered_map<std::string, Entry> table;  // command name -> entry
+  std::vector<std::string> names;                // every command name sorted, for completion
+  bool names_ready;                              // whether names matches table
+  int notify_fd;                                 // inotify descriptor watching dirs, -1 if none
+  pid_t owner;                                   // process watching, a forked copy reads no events
+  bool relative;                                 // whether some directory of PATH is relative
+  dev_t cwd_device;                              // device of working directory at scan time
+  ino_t cwd_inode;                               // inode of working directory at scan time
+  bool built;                                    // whether table is ready to use
+
+ public:
+  CommandCache() :
+      path_value(),
+      dirs(),
+      table(),
+      names(),
+      names_ready(false),
+      notify_fd(-1),
+      owner(-1),
+      relative(false),
+      cwd_device(0),
+      cwd_inode(0),
+      built(false) {}
+
+  ~CommandCache() { reset(); }
+
+  /*
+    Make sure table matches current PATH, rebuild it only if PATH changed, a watched directory
+    was removed or moved, a directory that isn't watched was modified since last scan, or
+    working directory changed while PATH has a relative directory.
+  */
+  void update(const char * env_path) {
+    std::string curt_path(env_path == nullptr ? "" : env_path);
+
+    if (!built || curt_path != path_value) { /* first use or PATH changed */
+      rebuild(curt_path);
+      return;
+    }
+
+    // relative directories now name other directories
+    if (relative) {
+      struct stat cwd;
+      if (stat(".", &cwd) != 0 || cwd.st_dev != cwd_device || cwd.st_ino != cwd_inode) {
+        rebuild(curt_path);
+        return;
+      }
+    }
+
+    // events belong to the shell, a forked copy of it checks modification times instead
+    if (notify_fd != -1 && owner != getpid()) {
+      close(notify_fd);
+      notify_fd = -1;
+      for (size_t i = 0; i < dirs.size(); i++) {
+        dirs[i].watch = -1;
+      }
+    }
+
+    // PATH is the same, take what changed in watched directories
+    if (notify_fd != -1 && !takeEvents()) {
+      rebuild(curt_path);
+      return;
+    }
+
+    // check modification time of every directory not watched
+    for (size_t i = 0; i < dirs.size(); i++) {
+      if (dirs[i].watch != -1) {
+        continue;
+      }
+      struct stat st;
+      bool exists = stat(dirs[i].name.c_str(), &st) == 0;
+      if (exists != dirs[i].exists ||
+          (exists && (st.st_mtim.tv_sec != dirs[i].mtime.tv_sec ||
+                      st.st_mtim.tv_nsec != dirs[i].mtime.tv_nsec))) {
+        rebuild(curt_path);
+        return;
+      }
+    }
+  }
+
+  /*
+    Find absolute path of command, empty string if not found.
+    Count a hit when the command is going to run.
+  */
+  std::string lookup(const std::string & command, bool hit = false) {
+    std::unordered_map<std::string, Entry>::iterator it = table.find(command);
+    if (it == table.end())
+      return "";
+    if (hit)
+      it->second.hits++;
+    return it->second.path;
+  }
+
+  /*
+    Add every command name starting with prefix to found, in sorted order.
+    Names are sorted once and then kept in order as programs come and go.
+  */
+  void complete(const std::string & prefix, std::vector<std::string> & found) {
+    if (!names_ready) {
+      names.clear();
+      names.reserve(table.size());
+      for (std::unordered_map<std::string, Entry>::const_iterator it = table.begin();
+           it != table.end();
+           ++it) {
+        names.push_back(it->first);
+      }
+      std::sort(names.begin(), names.end());
+      names_ready = true;
+    }
+    for (std::vector<std::string>::const_iterator it =
+             std::lower_bound(names.begin(), names.end(), prefix);
+         it != names.end() && it->compare(0, prefix.size(), prefix) == 0;
+         ++it) {
+      found.push_back(*it);
+    }
+  }
+
+  /*
+    Print hits and path of every command that has run, like bash's 'hash'.
+  */
+  void print() const {
+    bool empty = true;
+    for (std::unordered_map<std::string, Entry>::const_iterator it = table.begin();
+         it != table.end();
+         ++it) {
+      if (it->second.hits == 0)
+        continue;
+      if (empty) {
+        std::cout << "hits\tcommand\n";
+        empty = false;
+      }
+      std::cout << it->second.hits << "\t" << it->second.path << "\n";
+    }
+    if (empty) {
+      std::cout << "hash: hash table empty\n";
+    }
+  }
+
+  /*
+    Forget everything, next update() scans PATH again.
+  */
+  void reset() {
+    path_value.clear();
+    dirs.clear();
+    table.clear();
+    names.clear();
+    names_ready = false;
+    relative = false;
+    if (notify_fd != -1) { /* closing drops every watch */
+      close(notify_fd);
+      notify_fd = -1;
+    }
+    built = false;
+  }
+
+ private:
+  /*
+    Scan all directories in PATH and fill the table.
+    Earlier directory wins when a command exists in several of them.
+  */
+  void rebuild(const std::string & curt_path) {
+    reset();
+    path_value = curt_path;
+
+    // split PATH by ':', empty entries are ignored
+    size_t start = 0;
+    while (start <= curt_path.size()) {
+      size_t end = curt_path.find(':', start);
+      if (end == std::string::npos)
+        end = curt_path.size();
+      if (end > start) {
+        PathDir dir;
+        dir.name = curt_path.substr(start, end - start);
+        if (dir.name[dir.name.size() - 1] != '/')
+          dir.name += "/";
+        dir.exists = false;
+        dir.mtime.tv_sec = 0;
+        dir.mtime.tv_nsec = 0;
+        dir.watch = -1;
+        if (dir.name[0] != '/') {
+          relative = true;
+        }
+        dirs.push_back(dir);
+      }
+      start = end + 1;
+    }
+
+    // relative directories are looked up from working directory of this scan
+    struct stat cwd;
+    if (relative && stat(".", &cwd) == 0) {
+      cwd_device = cwd.st_dev;
+      cwd_inode = cwd.st_ino;
+    }
+
+    notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    owner = getpid();
+    for (size_t i = 0; i < dirs.size(); i++) {
+      scanDir(dirs[i], i);
+    }
+    built = true;
+  }
+
+  /*
+    Read pending inotify events and change entries of programs created or removed.
+    Return false if table cannot be kept right this way and must be rebuilt.
+  */
+  bool takeEvents() {
+    alignas(struct inotify_event) char buffer[4096];
+    for (;;) {
+      ssize_t len = read(notify_fd, buffer, sizeof(buffer));
+      if (len <= 0) {
+        return len == 0 || errno == EAGAIN || errno == EINTR;
+      }
+      for (ssize_t pos = 0; pos < len;) {
+        const struct inotify_event * event = reinterpret_cast<struct inotify_event *>(buffer + pos);
+        pos += sizeof(struct inotify_event) + event->len;
+        if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+          return false;
+        }
+        if ((event->mask & IN_ISDIR) || event->len == 0) { /* directories are never commands */
+          continue;
+        }
+        // a directory listed twice in PATH has one watch
+        for (size_t i = 0; i < dirs.size(); i++) {
+          if (dirs[i].watch != event->wd) {
+            continue;
+          }
+          std::string path = dirs[i].name + event->name;
+          if ((event->mask & (IN_CREATE | IN_MOVED_TO | IN_ATTRIB)) &&
+              access(path.c_str(), X_OK) == 0) {
+            added(i, event->name);
+          }
+          else if (event->mask & (IN_DELETE | IN_MOVED_FROM | IN_ATTRIB)) {
+            removed(i, event->name);
+          }
+        }
+      }
+    }
+  }
+
+  /*
+    Program name appeared in directory i, it wins over one found in a later directory.
+  */
+  void added(size_t i, const std::string & name) {
+    std::unordered_map<std::string, Entry>::iterator it = table.find(name);
+    if (it == table.end()) {
+      Entry found;
+      found.path = dirs[i].name + name;
+      found.hits = 0;
+      found.dir = i;
+      table[name] = found;
+      if (names_ready) {
+        names.insert(std::lower_bound(names.begin(), names.end(), name), name);
+      }
+    }
+    else if (it->second.dir > i) {
+      it->second.path = dirs[i].name + name;
+      it->second.hits = 0;
+      it->second.dir = i;
+    }
+  }
+
+  /*
+    Program name left directory i, a later directory may have one of the same name.
+  */
+  void removed(size_t i, const std::string & name) {
+    std::unordered_map<std::string, Entry>::iterator it = table.find(name);
+    if (it == table.end() || it->second.dir != i) {
+      return;
+    }
+    for (size_t j = i + 1; j < dirs.size(); j++) {
+      struct stat st;
+      std::string path = dirs[j].name + name;
+      if (stat(path.c_str(), &st) == 0 && !S_ISDIR(st.st_mode) && access(path.c_str(), X_OK) == 0) {
+        it->second.path = path;
+        it->second.hits = 0;
+        it->second.dir = j;
+        return;
+      }
+    }
+    table.erase(it);
+    if (names_ready) {
+      std::vector<std::string>::iterator at = std::lower_bound(names.begin(), names.end(), name);
+      if (at != names.end() && *at == name) {
+        names.erase(at);
+      }
+    }
+  }
+
+  /*
+    Helper function to add every file of directory number index that may be run into table.
+  */
+  void scanDir(PathDir & dir, size_t index) {
+    // watch and record modification time before reading, so a change during scan is noticed
+    struct stat st;
+    if (stat(dir.name.c_str(), &st) != 0) {
+      return;
+    }
+    dir.exists = true;
+    dir.mtime = st.st_mtim;
+    if (notify_fd != -1 && dir.name[0] == '/') {
+      dir.watch = inotify_add_watch(notify_fd, dir.name.c_str(), CACHE_WATCH_EVENTS | IN_ONLYDIR);
+    }
+
+    DIR * d = opendir(dir.name.c_str());
+    if (!d) {
+      return;
+    }
+
+    struct dirent * entry;
+    while ((entry = readdir(d)) != nullptr) {
+      // directories are never commands
+      if (entry->d_type == DT_DIR)
+        continue;
+
+      // handle . and ..
+      if (std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0)
+        continue;
+
+      // a data file is no command, lookup() would give it and running it would fail
+      std::string filename(entry->d_name);
+      if (table.find(filename) == table.end() && faccessat(dirfd(d), entry->d_name, X_OK, 0) == 0) {
+        Entry found;
+        found.path = dir.name + filename;
+        found.hits = 0;
+        found.dir = index;
+        table[filename] = found;
+      }
+    }
+    closedir(d);
+  }
+};
+
+#endif
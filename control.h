@@ -0,0 +1,604 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "lexer.h"
+#include "scriptinput.h"
+#include "vartable.h"
+
+#define CALL_DEPTH 1000 /* functions and sourced files running inside each other at most */
+#define CALL_ARGS 9     /* $1 to $9 are set in a call even if not given, so they are empty */
+
+/* How running commands of a block ends */
+enum Flow { FLOW_NORMAL, FLOW_BREAK, FLOW_CONTINUE, FLOW_RETURN, FLOW_EXIT };
+
+/*
+  One command of a block, parsed once when block is complete and run any number of times.
+  A plain command keeps its line compiled, so a loop body is never lexed again.
+*/
+struct ControlNode {
+  enum Kind { COMMAND, IF, WHILE, UNTIL, FOR, BREAK, CONTINUE, FUNCTION, RETURN };
+
+  Kind kind;
+  std::string text;                              // COMMAND: line as typed
+                                                 // FOR: variable name, FUNCTION: function name
+  std::string list;                              // FOR: words after "in", expanded when loop starts
+  int levels;                                    // BREAK, CONTINUE: how many loops it leaves
+                                                 // RETURN: status, -1 keeps last one
+  std::vector<std::vector<ControlNode> > parts;  // IF: condition, body, ... [, else body]
+                                                 // WHILE, UNTIL: condition, body; FOR: body
+                                                 // FUNCTION: body until it's closed
+  std::shared_ptr<std::vector<ControlNode> > body;  // FUNCTION: body shared with function table
+  bool prepared;                                 // COMMAND: whether fields below are set
+  bool exit;                                     // whether it's "exit"
+  bool timed;                                    // whether it starts with "time"
+  bool background;                               // whether it ends with '&'
+  std::string command;                           // line without "time", '&' and spaces around
+  LineTemplate words;                            // line compiled by lexer when it first runs
+
+  ControlNode(Kind curt_kind, const std::string & curt_text) :
+      kind(curt_kind),
+      text(curt_text),
+      list(),
+      levels(1),
+      parts(),
+      body(),
+      prepared(false),
+      exit(false),
+      timed(false),
+      background(false),
+      command(),
+      words() {}
+};
+
+/* What a function or sourced file changes while it runs, given back when it returns */
+struct CallFrame {
+  std::vector<std::string> positional;  // $1, $2, ... of caller
+  int loops;                            // loops of caller, "break" cannot leave them
+};
+
+/* Sourced file parsed once, used again while it's not changed */
+struct SourcedFile {
+  struct timespec mtime;                             // modification time when it was parsed
+  off_t size;                                        // size when it was parsed
+  ino_t ino;                                         // inode, another file put at same path
+  std::shared_ptr<std::vector<ControlNode> > nodes;  // commands of file
+};
+
+/*
+  Class for if/while/until/for blocks and functions, lines are collected until every compound
+  command is closed, then the whole block is run from its nodes.
+  Inside a block ';' ends a command like end of line does, "\;" is a plain ';'.
+  Functions and files read by "source" are kept parsed, so calling them again lexes nothing.
+*/
+class ControlFlow
+{
+ public:
+  enum Result { PARSE_MORE, PARSE_DONE, PARSE_ERROR };
+
+ private:
+  enum Stage { CONDITION, HEADER, BODY, ELSE };  // HEADER is "for" waiting for "do", or "f()" for '{'
+
+  typedef std::shared_ptr<std::vector<ControlNode> > Body;
+
+  /* Compound command being parsed */
+  struct Frame {
+    ControlNode node;  // parts filled so far
+    Stage stage;       // what lines go to now
+  };
+
+  std::vector<Frame> open;            // compound commands not closed yet, innermost last
+  std::vector<ControlNode> program;   // complete commands of block, run when nothing is open
+  int loops;                          // loops running now
+  int levels;                         // loops "break n" or "continue n" still has to leave
+  std::unordered_map<std::string, Body> functions;     // name -> body of function
+  std::unordered_map<std::string, SourcedFile> files;  // absolute path -> file parsed by "source"
+  std::vector<std::string> positional;                 // $1, $2, ... now
+  int calls;                                           // functions and sourced files running now
+
+ public:
+  ControlFlow() :
+      open(),
+      program(),
+      loops(0),
+      levels(0),
+      functions(),
+      files(),
+      positional(),
+      calls(0) {}
+
+  /*
+    Decide whether more lines are needed to close a block.
+  */
+  bool collecting() const { return !open.empty(); }
+
+  /*
+    Decide whether line starts with a reserved word, so it goes through add() even when
+    no block is open. Reserved words are never found through variables.
+  */
+  static bool startsBlock(const std::string & line) {
+    std::string name;
+    size_t after;
+    return isReserved(firstWord(line, 0, line.size())) ||
+           functionHead(line, 0, line.size(), name, after);
+  }
+
+  /*
+    Add one line of a block.
+    Return PARSE_DONE when block is complete and take() gives it, PARSE_MORE if it's still open.
+    On syntax error, it's printed and the whole block is dropped.
+  */
+  Result add(const std::string & line) {
+    // a line is cut at ';', not at "\;" or inside "$(...)"
+    size_t start = 0;
+    for (size_t i = 0; i <= line.size(); i++) {
+      if (i < line.size() && line[i] == '\\') {
+        i++;
+        continue;
+      }
+      if (i + 1 < line.size() && line[i] == '$' && line[i + 1] == '(') {
+        size_t close = closeSubstitution(line, i + 1);
+        if (close != std::string::npos) {
+          i = close;
+          continue;
+        }
+      }
+      if (i < line.size() && line[i] != ';') {
+        continue;
+      }
+      if (!addCommand(line, start, i)) {
+        open.clear();
+        program.clear();
+        return PARSE_ERROR;
+      }
+      start = i + 1;
+    }
+    return open.empty() ? PARSE_DONE : PARSE_MORE;
+  }
+
+  /*
+    Add one line of a sourced file, a line outside any block is a command as it is,
+    ';' is only special inside blocks like when the file is run as a script.
+  */
+  Result addLine(const std::string & line) {
+    if (open.empty() && !startsBlock(line)) {
+      if (line.find_first_not_of(' ') != std::string::npos) {
+        program.push_back(ControlNode(ControlNode::COMMAND, line));
+      }
+      return PARSE_DONE;
+    }
+    return add(line);
+  }
+
+  /*
+    Take complete block, it's moved out so it can run while next one is parsed.
+  */
+  void take(std::vector<ControlNode> & nodes) {
+    nodes.clear();
+    nodes.swap(program);
+  }
+
+  /*
+    Print error for input ending inside a block, and drop it.
+    Return false if no block was open.
+  */
+  bool endOfInput() {
+    if (open.empty()) {
+      return false;
+    }
+    std::cerr << "syntax error: unexpected end of file\n";
+    open.clear();
+    program.clear();
+    return true;
+  }
+
+  bool inLoop() const { return loops > 0; }
+  void enterLoop() { loops++; }
+  void leaveLoop() { loops--; }
+
+  /*
+    Start leaving loops for "break n" or "continue n", at most as many as are running.
+  */
+  void leave(int curt_levels) { levels = curt_levels < loops ? curt_levels : loops; }
+
+  /*
+    Decide what a loop does after its body ended with flow.
+    Return true if loop goes on, otherwise flow becomes what loop itself ends with.
+  */
+  bool goesOn(Flow & flow) {
+    if (flow == FLOW_NORMAL) {
+      return true;
+    }
+    if (flow == FLOW_RETURN || flow == FLOW_EXIT || --levels > 0) { /* leaves outer loop too */
+      return false;
+    }
+    bool again = flow == FLOW_CONTINUE;
+    flow = FLOW_NORMAL;
+    return again;
+  }
+
+  /*
+    Keep body of function, a call running the old one goes on with it.
+  */
+  void define(const std::string & name, const Body & body) { functions[name] = body; }
+
+  /*
+    Get body of function, empty if there's none with this name.
+  */
+  Body function(const char * name) const {
+    std::unordered_map<std::string, Body>::const_iterator it = functions.find(name);
+    return it == functions.end() ? Body() : it->second;
+  }
+
+  /*
+    Add name of every function starting with prefix to found.
+  */
+  void functionNames(const std::string & prefix, std::vector<std::string> & found) const {
+    for (std::unordered_map<std::string, Body>::const_iterator it = functions.begin();
+         it != functions.end();
+         ++it) {
+      if (it->first.compare(0, prefix.size(), prefix) == 0) {
+        found.push_back(it->first);
+      }
+    }
+  }
+
+  bool inCall() const { return calls > 0; }
+  const std::vector<std::string> & arguments() const { return positional; }
+
+  /*
+    Start a function or sourced file with args as $1, $2, ...
+    Return false if too many run inside each other already.
+  */
+  bool enterCall(VarTable & vars, const std::vector<std::string> & args, CallFrame & frame) {
+    if (calls >= CALL_DEPTH) {
+      return false;
+    }
+    calls++;
+    frame.positional = positional;
+    frame.loops = loops;
+    loops = 0;
+    std::vector<std::string> given(args);
+    if (given.size() < CALL_ARGS) {
+      given.resize(CALL_ARGS);
+    }
+    setPositional(vars, given);
+    return true;
+  }
+
+  /*
+    Give back $1, $2, ... and loops of caller.
+  */
+  void leaveCall(VarTable & vars, const CallFrame & frame) {
+    setPositional(vars, frame.positional);
+    loops = frame.loops;
+    calls--;
+  }
+
+  /*
+    Get commands of file at absolute path for "source". It's parsed only if it changed since
+    last time, otherwise it costs one stat().
+    Return empty on error, which is printed.
+  */
+  Body load(const std::string & path, const std::string & shown) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1) {
+      std::cerr << "source: " << shown << ": " << std::strerror(errno) << "\n";
+      return Body();
+    }
+    std::unordered_map<std::string, SourcedFile>::iterator it = files.find(path);
+    if (it != files.end() && it->second.size == st.st_size && it->second.ino == st.st_ino &&
+        it->second.mtime.tv_sec == st.st_mtim.tv_sec && it->second.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+      return it->second.nodes;
+    }
+
+    ScriptInput script;
+    if (!script.openFile(path.c_str())) {
+      std::cerr << "source: " << shown << ": " << std::strerror(errno) << "\n";
+      return Body();
+    }
+    std::string line;
+    while (script.next(line)) {
+      if (addLine(line) == PARSE_ERROR) {
+        return Body();
+      }
+    }
+    if (endOfInput()) {
+      return Body();
+    }
+
+    SourcedFile file;
+    file.mtime = st.st_mtim;
+    file.size = st.st_size;
+    file.ino = st.st_ino;
+    file.nodes = std::make_shared<std::vector<ControlNode> >();
+    take(*file.nodes);
+    files[path] = file;
+    return file.nodes;
+  }
+
+ private:
+  /*
+    Make args $1, $2, ... and remove those left from before.
+  */
+  void setPositional(VarTable & vars, const std::vector<std::string> & args) {
+    for (size_t i = args.size(); i < positional.size(); i++) {
+      vars.unset(std::to_string(i + 1));
+    }
+    for (size_t i = 0; i < args.size(); i++) {
+      vars.set(std::to_string(i + 1), args[i]);
+    }
+    positional = args;
+  }
+
+  /*
+    Get first word in line between start and end, words are separated by spaces.
+  */
+  static std::string firstWord(const std::string & line, size_t start, size_t end) {
+    size_t first = line.find_first_not_of(' ', start);
+    if (first == std::string::npos || first >= end) {
+      return "";
+    }
+    size_t last = first;
+    while (last < end && line[last] != ' ') {
+      last++;
+    }
+    return line.substr(first, last - first);
+  }
+
+  /*
+    Decide whether word is reserved, it starts or goes on a block.
+  */
+  static bool isReserved(const std::string & word) {
+    static const char * const reserved[] = {"if", "then", "elif", "else", "fi", "while", "until",
+                                            "for", "do", "done", "break", "continue", "return"};
+    for (size_t i = 0; i < sizeof(reserved) / sizeof(reserved[0]); i++) {
+      if (word == reserved[i]) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /*
+    Find "name()" or "name ()" between start and end, which defines a function.
+    Set name and after, position following "()".
+  */
+  static bool functionHead(const std::string & line,
+                           size_t start,
+                           size_t end,
+                           std::string & name,
+                           size_t & after) {
+    std::string word = firstWord(line, start, end);
+    size_t first = line.find_first_not_of(' ', start);
+    after = first + word.size();
+    if (word.size() > 2 && word.compare(word.size() - 2, 2, "()") == 0) {
+      name = word.substr(0, word.size() - 2);
+    }
+    else if (firstWord(line, after, end) == "()") {
+      name = word;
+      after = line.find_first_not_of(' ', after) + 2;
+    }
+    else {
+      return false;
+    }
+    if (name.empty() || isReserved(name)) {
+      return false;
+    }
+    for (size_t i = 0; i < name.size(); i++) {
+      if (!determineRange(name[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /*
+    Print error for reserved word in wrong place.
+  */
+  static bool unexpected(const std::string & word) {
+    std::cerr << "syntax error near unexpected token `" << word << "'\n";
+    return false;
+  }
+
+  /*
+    Put node where commands go now: innermost open part, or block itself.
+  */
+  void append(const ControlNode & node) {
+    if (open.empty()) {
+      program.push_back(node);
+    }
+    else {
+      open.back().node.parts.back().push_back(node);
+    }
+  }
+
+  /*
+    Check top compound command is kind in stage, and its current part has commands.
+  */
+  bool expect(ControlNode::Kind kind, Stage stage) const {
+    if (open.empty()) {
+      return false;
+    }
+    const Frame & top = open.back();
+    bool same_kind =
+        top.node.kind == kind || (kind == ControlNode::WHILE && top.node.kind == ControlNode::UNTIL);
+    return same_kind && top.stage == stage && (stage == HEADER || !top.node.parts.back().empty());
+  }
+
+  /*
+    Parse one command of a line, between start and end.
+    Return false on syntax error.
+  */
+  bool addCommand(const std::string & line, size_t start, size_t end) {
+    std::string word = firstWord(line, start, end);
+    if (word.empty()) {
+      return true;
+    }
+    size_t rest = line.find_first_not_of(' ', start) + word.size();  // what follows word
+    std::string after = line.substr(rest, end - rest);
+
+    if (word == "if" || word == "while" || word == "until") {
+      ControlNode::Kind kind =
+          word == "if" ? ControlNode::IF : word == "while" ? ControlNode::WHILE : ControlNode::UNTIL;
+      Frame frame = {ControlNode(kind, ""), CONDITION};
+      frame.node.parts.resize(1);
+      open.push_back(frame);
+      return addRest(after);
+    }
+    if (word == "for") {
+      return addFor(after);
+    }
+    std::string name;
+    size_t head_end;
+    if ((open.empty() || open.back().stage != HEADER) &&
+        functionHead(line, start, end, name, head_end)) {
+      Frame frame = {ControlNode(ControlNode::FUNCTION, name), HEADER};
+      frame.node.parts.resize(1);
+      open.push_back(frame);
+      return addCommand(line, head_end, end);
+    }
+    if (word == "{") {
+      if (!expect(ControlNode::FUNCTION, HEADER)) {
+        return unexpected(word);
+      }
+      open.back().stage = BODY;
+      return addRest(after);
+    }
+    if (word == "}" && expect(ControlNode::FUNCTION, BODY)) {
+      return close(after);
+    }
+    if (word == "then" || word == "elif" || word == "else") {
+      if (!expect(ControlNode::IF, word == "then" ? CONDITION : BODY)) {
+        return unexpected(word);
+      }
+      open.back().node.parts.resize(open.back().node.parts.size() + 1);
+      open.back().stage = word == "then" ? BODY : word == "elif" ? CONDITION : ELSE;
+      return addRest(after);
+    }
+    if (word == "fi") {
+      if (!expect(ControlNode::IF, BODY) && !expect(ControlNode::IF, ELSE)) {
+        return unexpected(word);
+      }
+      return close(after);
+    }
+    if (word == "do") {
+      if (!expect(ControlNode::WHILE, CONDITION) && !expect(ControlNode::FOR, HEADER)) {
+        return unexpected(word);
+      }
+      if (open.back().stage == CONDITION) {
+        open.back().node.parts.resize(2);
+      }
+      open.back().stage = BODY;
+      return addRest(after);
+    }
+    if (word == "done") {
+      if (!expect(ControlNode::WHILE, BODY) && !expect(ControlNode::FOR, BODY)) {
+        return unexpected(word);
+      }
+      return close(after);
+    }
+    if (!open.empty() && open.back().stage == HEADER) {
+      return unexpected(word);
+    }
+    if (word == "return") {
+      ControlNode node(ControlNode::RETURN, "");
+      node.levels = -1;
+      std::string status = firstWord(after, 0, after.size());
+      if (!status.empty()) {
+        char * last;
+        long value = strtol(status.c_str(), &last, 10);
+        if (*last != 0) {
+          std::cerr << "return: " << status << ": numeric argument required\n";
+          return false;
+        }
+        node.levels = value & 0xff;
+      }
+      append(node);
+      return true;
+    }
+    if (word == "break" || word == "continue") {
+      ControlNode node(word == "break" ? ControlNode::BREAK : ControlNode::CONTINUE, "");
+      std::string count = firstWord(after, 0, after.size());
+      if (!count.empty()) {
+        char * last;
+        long levels = strtol(count.c_str(), &last, 10);
+        if (*last != 0 || levels < 1) {
+          std::cerr << word << ": " << count << ": loop count out of range\n";
+          return false;
+        }
+        node.levels = levels;
+      }
+      append(node);
+      return true;
+    }
+    append(ControlNode(ControlNode::COMMAND, line.substr(start, end - start)));
+    return true;
+  }
+
+  /*
+    Parse what follows a reserved word on the same line, like "echo" of "then echo".
+  */
+  bool addRest(const std::string & after) { return addCommand(after, 0, after.size()); }
+
+  /*
+    Parse "for name in words", "do" may follow on the same line after ';'.
+  */
+  bool addFor(const std::string & after) {
+    std::string name = firstWord(after, 0, after.size());
+    if (name.empty()) {
+      return unexpected("newline");
+    }
+    for (size_t i = 0; i < name.size(); i++) {
+      if (!determineRange(name[i])) {
+        std::cerr << "for: invalid variable name\n";
+        return false;
+      }
+    }
+    Frame frame = {ControlNode(ControlNode::FOR, name), HEADER};
+    frame.node.parts.resize(1);
+
+    size_t rest = after.find_first_not_of(' ') + name.size();
+    std::string in = firstWord(after, rest, after.size());
+    if (!in.empty()) {
+      if (in != "in") {
+        return unexpected(in);
+      }
+      rest = after.find_first_not_of(' ', rest) + in.size();
+      frame.node.list = after.substr(rest);
+    }
+    open.push_back(frame);
+    return true;
+  }
+
+  /*
+    Close top compound command with "fi", "done" or '}', nothing but ';' may follow.
+  */
+  bool close(const std::string & after) {
+    std::string extra = firstWord(after, 0, after.size());
+    if (!extra.empty()) {
+      return unexpected(extra);
+    }
+    ControlNode node = open.back().node;
+    open.pop_back();
+    if (node.kind == ControlNode::FUNCTION) { /* body is kept once, defining it only shares it */
+      node.body = std::make_shared<std::vector<ControlNode> >();
+      node.body->swap(node.parts[0]);
+      node.parts.clear();
+    }
+    append(node);
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef DECIMAL_H
+#define DECIMAL_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/*
+  Class for value of a variable. It's kept as written, and checked to be a decimal number like
+  "-013.50" only when "inc", "add", "sub" or "mul" needs it. The parsed form stays next to the
+  string, so "inc" changes digits in place instead of parsing and building a new string.
+*/
+class Decimal
+{
+ private:
+  enum Parsed { UNKNOWN, NUMBER, NOT_NUMBER };
+
+  std::string text;     // value as written, like "+0099.50"
+  Parsed parsed;        // whether text was checked to be a number
+  bool negative;        // whether number starts with '-'
+  size_t digits_start;  // position of first integer digit, after sign
+  size_t point;         // position of '.', text.size() if there's none
+  size_t int_nonzero;   // number of nonzero digits before point
+  size_t frac_nonzero;  // number of nonzero digits after point
+
+ public:
+  Decimal() :
+      text(),
+      parsed(UNKNOWN),
+      negative(false),
+      digits_start(0),
+      point(0),
+      int_nonzero(0),
+      frac_nonzero(0) {}
+
+  explicit Decimal(const std::string & value) :
+      text(value),
+      parsed(UNKNOWN),
+      negative(false),
+      digits_start(0),
+      point(0),
+      int_nonzero(0),
+      frac_nonzero(0) {}
+
+  const std::string & str() const { return text; }
+
+  /*
+    Replace value, it will be checked again when used as number.
+  */
+  void assign(const std::string & value) {
+    text = value;
+    parsed = UNKNOWN;
+  }
+
+  /*
+    Check value is a number: optional '+' or '-', digits, and optional '.' followed by digits.
+    At least one digit and no '.' at the end, like "12", "-0.5", ".5" or "+007".
+  */
+  bool isNumber() {
+    if (parsed == UNKNOWN) {
+      parse();
+    }
+    return parsed == NUMBER;
+  }
+
+  /*
+    Add 1, value must be a number. Digits are changed in place, so counting up costs O(1)
+    on average. Leading zeros and fraction digits are kept, like "0099.5" -> "0100.5".
+    Negative numbers count towards zero, "-1" -> "-0", "-0" -> "1" and "-0.25" -> "0.75".
+  */
+  void increment() {
+    if (!negative) { /* add 1 to integer part, carry goes left */
+      size_t i = point;
+      while (i > digits_start && text[i - 1] == '9') {
+        text[i - 1] = '0';
+        int_nonzero--;
+        i--;
+      }
+      if (i > digits_start) {
+        if (text[i - 1] == '0') {
+          int_nonzero++;
+        }
+        text[i - 1]++;
+      }
+      else { /* still carry after all digits */
+        text.insert(digits_start, 1, '1');
+        point++;
+        int_nonzero++;
+      }
+    }
+    else if (int_nonzero == 0 && frac_nonzero == 0) { /* like -000.00 */
+      text = "1";
+      negative = false;
+      digits_start = 0;
+      point = 1;
+      int_nonzero = 1;
+      frac_nonzero = 0;
+    }
+    else if (int_nonzero > 0) { /* like -13.309, subtract 1 from integer part, fraction stays */
+      size_t i = point;
+      while (text[i - 1] == '0') {
+        text[i - 1] = '9';
+        int_nonzero++;
+        i--;
+      }
+      if (text[i - 1] == '1') {
+        int_nonzero--;
+      }
+      text[i - 1]--;
+    }
+    else { /* like -0.123, answer is 1 minus fraction */
+      std::string answer("0.");
+      size_t last = text.find_last_not_of('0');
+      for (size_t i = point + 1; i < text.size(); i++) {
+        if (i < last) {
+          answer += '9' - (text[i] - '0');
+        }
+        else if (i == last) {
+          answer += '0' + 10 - (text[i] - '0');
+        }
+        else {
+          answer += '0';
+        }
+      }
+      assign(answer);
+      parse();
+    }
+  }
+
+  /*
+    Add other number, which must be a number. Value counts as 0 if it's not a number.
+    Fraction keeps the longer one of both.
+  */
+  void add(const Decimal & other) { combine(other, false); }
+
+  /*
+    Subtract other number, which must be a number. Value counts as 0 if it's not a number.
+    Fraction keeps the longer one of both.
+  */
+  void subtract(const Decimal & other) { combine(other, true); }
+
+  /*
+    Multiply by other number, which must be a number. Value counts as 0 if it's not a number.
+    Fraction keeps every digit of product.
+  */
+  void multiply(const Decimal & other) {
+    if (!isNumber()) {
+      assign("0");
+      parse();
+    }
+    size_t frac_len = fracLength() + other.fracLength();
+    std::string a = magnitude(fracLength());
+    std::string b = other.magnitude(other.fracLength());
+
+    // schoolbook multiplication, lowest digit at the end
+    std::vector<unsigned> sums(a.size() + b.size(), 0);
+    for (size_t i = a.size(); i-- > 0;) {
+      for (size_t j = b.size(); j-- > 0;) {
+        sums[i + j + 1] += (a[i] - '0') * (b[j] - '0');
+      }
+    }
+    std::string product(sums.size(), '0');
+    unsigned carry = 0;
+    for (size_t k = sums.size(); k-- > 0;) {
+      unsigned digit = sums[k] + carry;
+      product[k] = '0' + digit % 10;
+      carry = digit / 10;
+    }
+
+    setResult(negative != other.negative, product, frac_len);
+  }
+
+ private:
+  /*
+    Find sign, point and nonzero digits of text, or mark it not a number.
+  */
+  void parse() {
+    parsed = NOT_NUMBER;
+    digits_start = !text.empty() && (text[0] == '-' || text[0] == '+') ? 1 : 0;
+    negative = digits_start == 1 && text[0] == '-';
+    point = text.size();
+    int_nonzero = 0;
+    frac_nonzero = 0;
+
+    bool has_digit = false;
+    for (size_t i = digits_start; i < text.size(); i++) {
+      char c = text[i];
+      if (c == '.' && point == text.size()) {
+        point = i;
+      }
+      else if (c < '0' || c > '9') {
+        return;
+      }
+      else {
+        has_digit = true;
+        if (c != '0') {
+          (point == text.size() ? int_nonzero : frac_nonzero)++;
+        }
+      }
+    }
+
+    // needs a digit, and no '.' at the end
+    if (has_digit && text[text.size() - 1] != '.') {
+      parsed = NUMBER;
+    }
+  }
+
+  size_t fracLength() const { return point == text.size() ? 0 : text.size() - point - 1; }
+
+  /*
+    Digits of integer and fraction part together, fraction padded with '0' to frac_len digits.
+  */
+  std::string magnitude(size_t frac_len) const {
+    std::string digits = text.substr(digits_start, point - digits_start);
+    if (point < text.size()) {
+      digits.append(text, point + 1, std::string::npos);
+    }
+    digits.append(frac_len - fracLength(), '0');
+    return digits;
+  }
+
+  /*
+    Add or subtract other number by comparing magnitudes of both.
+  */
+  void combine(const Decimal & other, bool subtract) {
+    if (!isNumber()) {
+      assign("0");
+      parse();
+    }
+    size_t frac_len = std::max(fracLength(), other.fracLength());
+    std::string a = magnitude(frac_len);
+    std::string b = other.magnitude(frac_len);
+    size_t len = std::max(a.size(), b.size()) + 1;  // one more digit for carry
+    a.insert(0, len - a.size(), '0');
+    b.insert(0, len - b.size(), '0');
+    bool other_negative = other.negative != subtract;
+
+    if (negative == other_negative) { /* same sign, add magnitudes */
+      int carry = 0;
+      for (size_t i = len; i-- > 0;) {
+        int digit = (a[i] - '0') + (b[i] - '0') + carry;
+        a[i] = '0' + digit % 10;
+        carry = digit / 10;
+      }
+      setResult(negative, a, frac_len);
+      return;
+    }
+
+    // different signs, subtract smaller magnitude from bigger one
+    bool result_negative = negative;
+    if (a < b) {
+      a.swap(b);
+      result_negative = other_negative;
+    }
+    int borrow = 0;
+    for (size_t i = len; i-- > 0;) {
+      int digit = (a[i] - '0') - (b[i] - '0') - borrow;
+      borrow = digit < 0 ? 1 : 0;
+      a[i] = '0' + digit + borrow * 10;
+    }
+    setResult(result_negative, a, frac_len);
+  }
+
+  /*
+    Write result given by digits with last frac_len of them after point.
+    Zero padded integer part keeps at least as many digits as before, like "0007" -> "0012".
+    '+' is kept, and zero has no '-'.
+  */
+  void setResult(bool result_negative, const std::string & digits, size_t frac_len) {
+    bool plus = digits_start == 1 && !negative;
+    size_t width = point - digits_start;
+    if (width < 2 || text[digits_start] != '0') { /* only zero padded numbers keep width */
+      width = 0;
+    }
+    size_t int_len = digits.size() - frac_len;
+
+    size_t first = digits.find_first_not_of('0');
+    bool zero = first == std::string::npos;
+    first = zero ? int_len : std::min(first, int_len);
+    size_t int_digits = std::max(std::max(int_len - first, width), (size_t)1);
+
+    std::string answer;
+    if (result_negative && !zero) {
+      answer += '-';
+    }
+    else if (plus) {
+      answer += '+';
+    }
+    answer.append(int_digits - (int_len - first), '0');
+    answer.append(digits, first, int_len - first);
+    if (frac_len > 0) {
+      answer += '.';
+      answer.append(digits, int_len, frac_len);
+    }
+
+    assign(answer);
+    parse();
+  }
+};
+
+#endif
@@ -0,0 +1,628 @@
+#ifndef EDITOR_H
+#define EDITOR_H
+
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "glob.h"
+#include "history.h"
+
+#define EDITOR_LIST_MAX 300 /* completions listed at most, the rest are only counted */
+#define EDITOR_COLUMNS 80   /* terminal width when it cannot be asked */
+
+/*
+  Get code a key sends with Ctrl held, like ctrlKey('a') for Ctrl-A.
+*/
+constexpr char ctrlKey(char c) {
+  return c & 0x1f;
+}
+
+/*
+  Class for completing file names from directory listings kept between completions.
+  A listing is read again only when modification time of its directory changed, so pressing
+  Tab in a directory of 100000 files costs one stat() after the first time.
+*/
+class FileCompleter
+{
+ private:
+  /* Listing of one directory with the time it was read at */
+  struct CachedDir {
+    struct timespec mtime;  // modification time of directory when listing was read
+    DirListing listing;     // entries of directory
+  };
+
+  std::unordered_map<std::string, CachedDir> dirs;  // absolute directory -> its listing
+  std::vector<char> scratch;                        // buffer getdents64 fills
+
+ public:
+  FileCompleter() : dirs(), scratch() {}
+
+  /*
+    Add every file name word may become to found, sorted, directories ending with '/'.
+    Word is as typed without '\', relative to directory cwd.
+  */
+  void complete(const std::string & word,
+                const std::string & cwd,
+                std::vector<std::string> & found) {
+    size_t slash = word.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "" : word.substr(0, slash + 1);
+    std::string base = word.substr(dir.size());
+    std::string key = !dir.empty() && dir[0] == '/' ? dir : cwd + "/" + dir;
+
+    struct stat info;
+    if (stat(key.c_str(), &info) != 0) {
+      return;
+    }
+    CachedDir & cached = dirs[key];
+    if (!cached.listing.opened || cached.mtime.tv_sec != info.st_mtim.tv_sec ||
+        cached.mtime.tv_nsec != info.st_mtim.tv_nsec) {
+      cached.listing.read(key, scratch);
+      cached.mtime = info.st_mtim;
+    }
+
+    size_t first = found.size();
+    size_t offset = 0;
+    while (const struct dirent64 * entry = cached.listing.next(offset)) {
+      const char * name = entry->d_name;
+      if (std::strncmp(name, base.c_str(), base.size()) != 0 ||
+          isHiddenFrom(name, base.empty() ? "*" : base.c_str())) {
+        continue;
+      }
+      found.push_back(dir + name);
+      if (isDirEntry(key, entry, true)) {
+        found.back() += '/';
+      }
+    }
+    std::sort(found.begin() + first, found.end());
+  }
+};
+
+/*
+  Class for reading a line typed on a terminal in raw mode, with moving inside the line,
+  deleting, Tab completing the word before the cursor, Up and Down going through history and
+  Ctrl-R searching it. Only the part of the line after a change is drawn again, so the prompt
+  is printed only after completions are listed.
+*/
+class LineEditor
+{
+ public:
+  // find what a word may become, bool tells if word is in place of a command name
+  typedef std::function<void(const std::string &, bool, std::vector<std::string> &)> Completer;
+
+ private:
+  std::string line;               // line being typed
+  size_t cursor;                  // byte of line cursor is at
+  Completer completer;            // gives completions, nothing is completed if it's empty
+  std::vector<std::string> found;  // completions of word at cursor
+  std::string out;                // what to write to terminal after a key
+  History * history;              // lines typed before, nullptr when there's no history
+  size_t browsing;                // offset in history of line shown by Up, npos when none is
+  std::string typed;              // line typed before going through history
+  bool terminal;                  // whether input is a terminal, otherwise lines are only read
+
+ public:
+  LineEditor() :
+      line(),
+      cursor(0),
+      completer(),
+      found(),
+      out(),
+      history(nullptr),
+      browsing(std::string::npos),
+      typed(),
+      terminal(isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)) {}
+
+  void setCompleter(const Completer & curt_completer) { completer = curt_completer; }
+  void setHistory(History * curt_history) { history = curt_history; }
+  bool onTerminal() const { return terminal; }
+
+  /*
+    Read one line into input after prompt was printed. Return false at end of input,
+    or when Ctrl-D is typed on an empty line.
+  */
+  bool readLine(std::string & input, const std::string & prompt) {
+    struct termios cooked;
+    if (!terminal || tcgetattr(STDIN_FILENO, &cooked) == -1) {
+      return static_cast<bool>(std::getline(std::cin, input));
+    }
+    std::cout.flush();
+
+    // keys come one by one and nothing is echoed, Ctrl-C and Ctrl-Z are keys too
+    struct termios raw = cooked;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_iflag &= ~(IXON | ICRNL | INLCR);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+    line.clear();
+    cursor = 0;
+    browsing = std::string::npos;
+    bool got = edit(prompt);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &cooked);
+    input = line;
+    return got;
+  }
+
+ private:
+  /*
+    Act on keys until Enter, return false at end of input.
+  */
+  bool edit(const std::string & prompt) {
+    for (;;) {
+      char c;
+      if (!readKey(c)) {
+        return !line.empty();
+      }
+      if (c == '\r' || c == '\n') {
+        out += "\n";
+        flush();
+        return true;
+      }
+      switch (c) {
+        case ctrlKey('d'):
+          if (line.empty()) {
+            out += "\n";
+            flush();
+            return false;
+          }
+          erase(cursor, nextChar(cursor) - cursor);
+          break;
+        case ctrlKey('c'): /* forget line, like bash */
+          out += "^C\n";
+          flush();
+          line.clear();
+          return true;
+        case 127:
+        case ctrlKey('h'):
+          if (cursor > 0) {
+            size_t from = previousChar(cursor);
+            erase(from, cursor - from);
+          }
+          break;
+        case ctrlKey('a'):
+          moveTo(0);
+          break;
+        case ctrlKey('e'):
+          moveTo(line.size());
+          break;
+        case ctrlKey('b'):
+          moveTo(previousChar(cursor));
+          break;
+        case ctrlKey('f'):
+          moveTo(nextChar(cursor));
+          break;
+        case ctrlKey('u'):
+          erase(0, cursor);
+          break;
+        case ctrlKey('k'):
+          erase(cursor, line.size() - cursor);
+          break;
+        case ctrlKey('w'): { /* word before cursor with spaces after it */
+          size_t from = cursor;
+          while (from > 0 && line[from - 1] == ' ') {
+            from--;
+          }
+          while (from > 0 && line[from - 1] != ' ') {
+            from--;
+          }
+          erase(from, cursor - from);
+          break;
+        }
+        case ctrlKey('l'):
+          out += "\033[H\033[2J";
+          redraw(prompt);
+          break;
+        case '\t':
+          complete(prompt);
+          break;
+        case ctrlKey('p'):
+          older();
+          break;
+        case ctrlKey('n'):
+          newer();
+          break;
+        case ctrlKey('r'):
+          if (reverseSearch(prompt)) {
+            out += "\n";
+            flush();
+            return true;
+          }
+          break;
+        case '\033':
+          escape();
+          break;
+        default:
+          if (static_cast<unsigned char>(c) >= ' ') {
+            insert(std::string(1, c));
+          }
+      }
+      flush();
+    }
+  }
+
+  /*
+    Handle keys sending an escape sequence: arrows, Home, End and Delete.
+  */
+  void escape() {
+    char kind;
+    char key;
+    if (!readKey(kind) || (kind != '[' && kind != 'O') || !readKey(key)) {
+      return;
+    }
+    if (key >= '0' && key <= '9') { /* like "\033[3~", number ends with '~' */
+      char end;
+      if (!readKey(end) || end != '~') {
+        return;
+      }
+      if (key == '3') {
+        erase(cursor, nextChar(cursor) - cursor);
+      }
+      else if (key == '1' || key == '7') {
+        moveTo(0);
+      }
+      else if (key == '4' || key == '8') {
+        moveTo(line.size());
+      }
+      return;
+    }
+    if (key == 'A') {
+      older();
+    }
+    else if (key == 'B') {
+      newer();
+    }
+    else if (key == 'C') {
+      moveTo(nextChar(cursor));
+    }
+    else if (key == 'D') {
+      moveTo(previousChar(cursor));
+    }
+    else if (key == 'H') {
+      moveTo(0);
+    }
+    else if (key == 'F') {
+      moveTo(line.size());
+    }
+  }
+
+  /*
+    Show line of history before the one shown, the line being typed is kept for newer().
+  */
+  void older() {
+    size_t pos = browsing;
+    std::string entry;
+    if (history == nullptr || !history->previous(pos, entry)) {
+      out += "\a";
+      return;
+    }
+    if (browsing == std::string::npos) {
+      typed = line;
+    }
+    browsing = pos;
+    replaceLine(entry);
+  }
+
+  /*
+    Show line of history after the one shown, or the line that was being typed after the last.
+  */
+  void newer() {
+    if (browsing == std::string::npos) {
+      out += "\a";
+      return;
+    }
+    std::string entry;
+    if (history->next(browsing, entry)) {
+      replaceLine(entry);
+      return;
+    }
+    browsing = std::string::npos;
+    replaceLine(typed);
+  }
+
+  void replaceLine(const std::string & text) {
+    erase(0, line.size());
+    insert(text);
+  }
+
+  /*
+    Search history for newest line having what is typed, like bash's Ctrl-R: typing narrows
+    search, Ctrl-R again finds an older line, Enter runs line found, Ctrl-G or Ctrl-C gives
+    back the line as it was, and any other key keeps line found for editing.
+    Return true if line should run.
+  */
+  bool reverseSearch(const std::string & prompt) {
+    if (history == nullptr) {
+      out += "\a";
+      return false;
+    }
+    std::string before = line;
+    std::string query;
+    std::string found_line = line;
+    size_t at = std::string::npos;  // offset of line found in history
+    bool run = false;
+    for (;;) {
+      out += "\r\033[K(reverse-i-search)`" + query + "': " + found_line;
+      flush();
+      char c;
+      if (!readKey(c)) {
+        break;
+      }
+      if (c == ctrlKey('g') || c == ctrlKey('c')) {
+        found_line = before;
+        break;
+      }
+      if (c == '\r' || c == '\n') {
+        run = true;
+        break;
+      }
+      std::string entry;
+      size_t got = std::string::npos;
+      if (c == ctrlKey('r')) { /* older line with the same text */
+        got = history->search(query, at, entry);
+      }
+      else if (c == 127 || c == ctrlKey('h')) {
+        if (!query.empty()) {
+          query.erase(query.size() - 1);
+        }
+        got = history->search(query, std::string::npos, entry);
+      }
+      else if (static_cast<unsigned char>(c) >= ' ') { /* line found so far may still have it */
+        query += c;
+        size_t before_end = at == std::string::npos ? at : at + found_line.size() + 1;
+        got = history->search(query, before_end, entry);
+      }
+      else {
+        if (c == '\033') { /* drop rest of arrow key */
+          char rest;
+          readKey(rest) && readKey(rest);
+        }
+        break;
+      }
+      if (got == std::string::npos) {
+        out += "\a";
+      }
+      else {
+        at = got;
+        found_line = entry;
+      }
+    }
+
+    // only last line of prompt was written over
+    line = found_line;
+    cursor = line.size();
+    out += "\r\033[K";
+    out.append(prompt, prompt.find_last_of('\n') + 1, std::string::npos);
+    out += line;
+    return run;
+  }
+
+  /*
+    Complete word before cursor: one completion is put in with a space after it, several put in
+    what they all start with, or are listed when they start with nothing more than the word.
+  */
+  void complete(const std::string & prompt) {
+    if (!completer) {
+      return;
+    }
+
+    // word starts after a space or operator, "\ " is a space inside it
+    size_t start = cursor;
+    while (start > 0 && (std::strchr(" |;&<>(", line[start - 1]) == nullptr ||
+                         (start > 1 && line[start - 2] == '\\'))) {
+      start--;
+    }
+    std::string word;
+    for (size_t i = start; i < cursor; i++) {
+      if (line[i] != '\\' || i + 1 == cursor) {
+        word += line[i];
+      }
+      else {
+        word += line[++i];
+      }
+    }
+
+    found.clear();
+    completer(word, isCommandPlace(start), found);
+    if (found.empty()) {
+      out += "\a";
+      return;
+    }
+
+    // what every completion starts with
+    std::string common = found[0];
+    for (size_t i = 1; i < found.size(); i++) {
+      size_t same = 0;
+      while (same < common.size() && same < found[i].size() && common[same] == found[i][same]) {
+        same++;
+      }
+      common.erase(same);
+    }
+    if (found.size() == 1 && common[common.size() - 1] != '/') {
+      common += ' ';
+    }
+    if (common.size() > word.size() || found.size() == 1) {
+      std::string escaped;
+      for (size_t i = 0; i < common.size(); i++) {
+        if (common[i] == ' ' && i + 1 < common.size()) { /* space inside a name */
+          escaped += '\\';
+        }
+        escaped += common[i];
+      }
+      erase(start, cursor - start);
+      insert(escaped);
+      return;
+    }
+    list(word, prompt);
+  }
+
+  /*
+    Check whether word starting at start is in place of a command name: first of line, after an
+    operator, or after a word like "if" or "do" starting a command.
+  */
+  bool isCommandPlace(size_t start) const {
+    size_t end = start;
+    while (end > 0 && line[end - 1] == ' ') {
+      end--;
+    }
+    if (end == 0 || std::strchr("|;&(", line[end - 1]) != nullptr) {
+      return true;
+    }
+    size_t begin = end;
+    while (begin > 0 && line[begin - 1] != ' ') {
+      begin--;
+    }
+    const char * starters[] = {"if", "then", "else", "elif", "do", "while", "until", "time", "!"};
+    for (size_t i = 0; i < sizeof(starters) / sizeof(starters[0]); i++) {
+      if (line.compare(begin, end - begin, starters[i]) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /*
+    Print completions in columns under the line, then prompt and line again.
+  */
+  void list(const std::string & word, const std::string & prompt) {
+    size_t cut = word.find_last_of('/');
+    cut = cut == std::string::npos ? 0 : cut + 1;  // only last part of file names is shown
+    size_t shown = std::min(found.size(), (size_t)EDITOR_LIST_MAX);
+    size_t width = 0;
+    for (size_t i = 0; i < shown; i++) {
+      width = std::max(width, found[i].size() - cut + 2);
+    }
+
+    struct winsize size;
+    size_t columns = ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 ? size.ws_col
+                                                                                  : EDITOR_COLUMNS;
+    size_t per_row = std::max((size_t)1, columns / width);
+    size_t rows = (shown + per_row - 1) / per_row;
+
+    moveTo(line.size());
+    out += "\n";
+    for (size_t r = 0; r < rows; r++) {
+      for (size_t k = r; k < shown; k += rows) {
+        std::string name = found[k].substr(cut);
+        out += name;
+        if (k + rows < shown) {
+          out.append(width - name.size(), ' ');
+        }
+      }
+      out += "\n";
+    }
+    if (shown < found.size()) {
+      out += "... and " + std::to_string(found.size() - shown) + " more\n";
+    }
+    redraw(prompt);
+  }
+
+  /*
+    Print prompt and whole line, cursor where it was.
+  */
+  void redraw(const std::string & prompt) {
+    size_t at = cursor;
+    out += prompt;
+    out += line;
+    cursor = line.size();
+    moveTo(at);
+  }
+
+  /*
+    Put text at cursor, cursor goes after it.
+  */
+  void insert(const std::string & text) {
+    line.insert(cursor, text);
+    out.append(line, cursor, std::string::npos);
+    size_t at = cursor + text.size();
+    cursor = line.size();
+    moveTo(at);
+  }
+
+  /*
+    Delete count bytes of line from byte from, cursor goes there.
+  */
+  void erase(size_t from, size_t count) {
+    if (count == 0) {
+      return;
+    }
+    moveTo(from);
+    line.erase(from, count);
+    out.append(line, from, std::string::npos);
+    out += "\033[K";
+    cursor = line.size();
+    moveTo(from);
+  }
+
+  /*
+    Move cursor to byte to, terminal moves one column for each character between.
+  */
+  void moveTo(size_t to) {
+    size_t from = std::min(cursor, to);
+    size_t until = std::max(cursor, to);
+    size_t chars = 0;
+    for (size_t i = from; i < until; i++) {
+      if ((line[i] & 0xc0) != 0x80) { /* not a continuation byte of UTF-8 */
+        chars++;
+      }
+    }
+    if (chars > 0) {
+      out += "\033[" + std::to_string(chars) + (to < cursor ? "D" : "C");
+    }
+    cursor = to;
+  }
+
+  size_t previousChar(size_t at) const {
+    while (at > 0 && (line[--at] & 0xc0) == 0x80) {
+    }
+    return at;
+  }
+
+  size_t nextChar(size_t at) const {
+    if (at < line.size()) {
+      at++;
+    }
+    while (at < line.size() && (line[at] & 0xc0) == 0x80) {
+      at++;
+    }
+    return at;
+  }
+
+  static bool readKey(char & c) {
+    ssize_t len;
+    while ((len = read(STDIN_FILENO, &c, 1)) == -1 && errno == EINTR) {
+    }
+    return len == 1;
+  }
+
+  /*
+    Write what keys changed with one write().
+  */
+  void flush() {
+    size_t done = 0;
+    while (done < out.size()) {
+      ssize_t len = write(STDOUT_FILENO, out.data() + done, out.size() - done);
+      if (len == -1 && errno == EINTR) {
+        continue;
+      }
+      if (len <= 0) {
+        break;
+      }
+      done += len;
+    }
+    out.clear();
+  }
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef ENVSTORE_H
+#define ENVSTORE_H
+
+#include <stdlib.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern char ** environ;
+
+/* Class for environment variables given to programs, array is rebuilt only after a change */
+class EnvStore
+{
+ private:
+  std::vector<char *> envp;  // snapshot of environ, ends with nullptr
+  std::string path_value;    // value of PATH in snapshot
+  bool has_path;             // whether PATH exists in snapshot
+  bool dirty;                // whether environ changed since snapshot
+  unsigned long version;     // increases every time environ changes
+
+ public:
+  EnvStore() : envp(), path_value(), has_path(false), dirty(true), version(0) {}
+
+  /*
+    Set environment variable, return false if it cannot be set.
+    Setting the same value again keeps the snapshot.
+  */
+  bool set(const char * key, const char * value) {
+    const char * old_value = getenv(key);
+    if (old_value != nullptr && value != nullptr && std::strcmp(old_value, value) == 0) {
+      return true;
+    }
+    if (setenv(key, value, 1) != 0) {
+      return false;
+    }
+    dirty = true;
+    version++;
+    return true;
+  }
+
+  /*
+    Get environment array for execve(), the same array until something changes.
+  */
+  char ** get() {
+    if (dirty) {
+      rebuild();
+    }
+    return &envp[0];
+  }
+
+  /*
+    Get PATH, nullptr if there's no PATH.
+  */
+  const char * path() {
+    if (dirty) {
+      rebuild();
+    }
+    return has_path ? path_value.c_str() : nullptr;
+  }
+
+  unsigned long getVersion() const { return version; }
+
+ private:
+  /*
+    Take a new snapshot of environ.
+  */
+  void rebuild() {
+    envp.clear();
+    for (char ** env = environ; *env != nullptr; ++env) {
+      envp.push_back(*env);
+    }
+    envp.push_back(nullptr);
+
+    const char * curt_path = getenv("PATH");
+    has_path = curt_path != nullptr;
+    path_value = has_path ? curt_path : "";
+    dirty = false;
+  }
+};
+
+#endif
@@ -0,0 +1,435 @@
+#ifndef GLOB_H
+#define GLOB_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define GLOB_DIRENT_BUFFER (1 << 18) /* bytes asked from getdents64 at once */
+#define GLOB_PARALLEL_DIRS 64        /* directories waiting before "**" walk starts threads */
+#define GLOB_MAX_THREADS 8           /* threads walking one "**" at most */
+
+/*
+  Check character may start a pattern, cheap enough to ask for every character lexed.
+*/
+bool isGlobChar(char c) {
+  return c == '*' || c == '?' || c == '[';
+}
+
+/*
+  Match c against bracket expression "[...]" starting at p, pattern ends at end.
+  Return 1 if it matches, 0 if not, -1 if '[' has no closing ']' and is a plain character.
+  After is set to the character following the closing ']'.
+*/
+int matchBracket(const char * p, const char * end, char c, const char *& after) {
+  const char * q = p + 1;
+  bool negate = q < end && (*q == '!' || *q == '^');
+  if (negate) {
+    q++;
+  }
+  bool found = false;
+  bool first = true;  // ']' right after '[' or "[!" is a member, not the end
+  for (; q < end && (*q != ']' || first); q++) {
+    first = false;
+    if (q + 2 < end && q[1] == '-' && q[2] != ']') { /* range like a-z */
+      found = found || (static_cast<unsigned char>(*q) <= static_cast<unsigned char>(c) &&
+                        static_cast<unsigned char>(c) <= static_cast<unsigned char>(q[2]));
+      q += 2;
+    }
+    else {
+      found = found || *q == c;
+    }
+  }
+  if (q == end) {
+    return -1;
+  }
+  after = q + 1;
+  return found != negate ? 1 : 0;
+}
+
+/*
+  Check whether word has '*', '?' or a closed "[...]", so it is expanded to file names.
+*/
+bool isPattern(const char * word, size_t length) {
+  const char * end = word + length;
+  for (const char * p = word; p < end; p++) {
+    const char * after;
+    if (*p == '*' || *p == '?' || (*p == '[' && matchBracket(p, end, 0, after) != -1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+  Match file name against pattern between p and end, like fnmatch() without flags.
+  Works on the name where getdents64 put it, nothing is copied.
+*/
+bool matchPattern(const char * p, const char * end, const char * name) {
+  const char * star = nullptr;        // pattern after last '*' seen
+  const char * star_name = nullptr;   // name where that '*' matches from
+  while (*name != 0) {
+    if (p < end && *p == '*') {
+      star = ++p;
+      star_name = name;
+      continue;
+    }
+    if (p < end) {
+      const char * next = p + 1;
+      bool same = *p == '?' || *p == *name;
+      if (*p == '[') {
+        int found = matchBracket(p, end, *name, next);
+        same = found == -1 ? *name == '[' : found == 1;
+        if (found == -1) {
+          next = p + 1;
+        }
+      }
+      if (same) {
+        p = next;
+        name++;
+        continue;
+      }
+    }
+    if (star == nullptr) {
+      return false;
+    }
+    // let last '*' take one more character and try again
+    p = star;
+    name = ++star_name;
+  }
+  while (p < end && *p == '*') {
+    p++;
+  }
+  return p == end;
+}
+
+/* Entries of one directory as getdents64 gave them, names are matched in place */
+struct DirListing {
+  std::vector<char> entries;  // struct dirent64 records one after another
+  bool opened;                // false if directory could not be read, then entries is empty
+
+  DirListing() : entries(), opened(false) {}
+
+  /*
+    Read directory with large getdents64 calls into scratch, kept by caller for every directory,
+    so a small directory costs only what it holds. Path "" is current directory.
+  */
+  void read(const std::string & path, std::vector<char> & scratch) {
+    entries.clear();
+    int fd = open(path.empty() ? "." : path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    opened = fd != -1;
+    if (!opened) {
+      return;
+    }
+    scratch.resize(GLOB_DIRENT_BUFFER);
+    long got;
+    while ((got = syscall(SYS_getdents64, fd, &scratch[0], scratch.size())) > 0) {
+      entries.insert(entries.end(), scratch.begin(), scratch.begin() + got);
+    }
+    close(fd);
+  }
+
+  /*
+    Get entry at offset and move offset to next one, nullptr after last.
+  */
+  const struct dirent64 * next(size_t & offset) const {
+    if (offset >= entries.size()) {
+      return nullptr;
+    }
+    const struct dirent64 * entry = reinterpret_cast<const struct dirent64 *>(&entries[offset]);
+    offset += entry->d_reclen;
+    return entry;
+  }
+};
+
+/*
+  Check whether entry of directory dir is a directory itself. Symbolic links count only when
+  follow is true, "**" never walks through them.
+*/
+bool isDirEntry(const std::string & dir, const struct dirent64 * entry, bool follow) {
+  if (entry->d_type == DT_DIR) {
+    return true;
+  }
+  if (entry->d_type != DT_UNKNOWN && (entry->d_type != DT_LNK || !follow)) {
+    return false;
+  }
+  struct stat info;
+  std::string path = dir + entry->d_name;
+  int got = follow ? stat(path.c_str(), &info) : lstat(path.c_str(), &info);
+  return got == 0 && S_ISDIR(info.st_mode);
+}
+
+/*
+  Check whether a name is skipped by patterns: "." and ".." always, other hidden names unless
+  pattern starts with '.' itself.
+*/
+bool isHiddenFrom(const char * name, const char * pattern) {
+  if (name[0] != '.') {
+    return false;
+  }
+  return pattern[0] != '.' || name[1] == 0 || (name[1] == '.' && name[2] == 0);
+}
+
+/*
+  Class to expand patterns like "*.log" and "src/?.[ch]" to the file names they match.
+  Each directory is read once per line and kept, so several patterns of one line in the same
+  directory list it only once. A component "**" matches any number of directories, and a big tree
+  under it is walked by several threads at once.
+*/
+class Globber
+{
+ private:
+  std::unordered_map<std::string, DirListing> listings;  // directories read during current line
+  std::vector<std::pair<size_t, size_t>> parts;          // start and length of each component
+  std::vector<std::string> dirs;                         // directories current component looks in
+  std::vector<std::string> next_dirs;                    // directories next component looks in
+  std::vector<char> scratch;                             // buffer getdents64 fills
+
+ public:
+  Globber() : listings(), parts(), dirs(), next_dirs(), scratch() {}
+
+  /*
+    Forget directories read, a new line may see them changed.
+  */
+  void forget() {
+    if (!listings.empty()) {
+      listings.clear();
+    }
+  }
+
+  /*
+    Append every name pattern matches to out, each ending with '\0', and their offsets to starts,
+    sorted like "ls". Return how many matched, 0 means pattern should be kept as typed.
+  */
+  size_t expand(const std::string & pattern, std::string & out, std::vector<size_t> & starts) {
+    // cut into components, a '/' at the end keeps only directories
+    parts.clear();
+    size_t end = pattern.find_last_not_of('/');
+    bool only_dirs = end != std::string::npos && end + 1 < pattern.size();
+    end = end == std::string::npos ? 0 : end + 1;
+    for (size_t pos = 0; pos < end;) {
+      size_t slash = std::min(pattern.find('/', pos), end);
+      if (slash > pos) {
+        parts.push_back(std::make_pair(pos, slash - pos));
+      }
+      pos = slash + 1;
+    }
+
+    dirs.assign(1, pattern[0] == '/' ? "/" : "");
+    size_t first = starts.size();
+    for (size_t i = 0; i < parts.size() && !dirs.empty(); i++) {
+      const char * part = pattern.c_str() + parts[i].first;
+      size_t length = parts[i].second;
+      bool last = i + 1 == parts.size();
+      next_dirs.clear();
+
+      if (length == 2 && part[0] == '*' && part[1] == '*') { /* any number of directories */
+        for (size_t d = 0; d < dirs.size(); d++) {
+          size_t from = next_dirs.size();
+          next_dirs.push_back(dirs[d]);
+          walk(dirs[d], next_dirs);
+          if (!last) {
+            continue;
+          }
+          // "**" at the end: everything under those directories, "**/" only the directories
+          for (size_t k = from; k < next_dirs.size(); k++) {
+            if (only_dirs) {
+              if (k > from) {
+                addMatch(next_dirs[k], "", "", out, starts);
+              }
+              continue;
+            }
+            const DirListing & listing = list(next_dirs[k]);
+            size_t offset = 0;
+            while (const struct dirent64 * entry = listing.next(offset)) {
+              if (!isHiddenFrom(entry->d_name, "*")) {
+                addMatch(next_dirs[k], entry->d_name, "", out, starts);
+              }
+            }
+          }
+        }
+      }
+      else if (!isPattern(part, length)) { /* plain name, no need to read directory */
+        for (size_t d = 0; d < dirs.size(); d++) {
+          std::string path = dirs[d];
+          path.append(part, length);
+          if (!last) {
+            next_dirs.push_back(path + "/");
+            continue;
+          }
+          struct stat info;
+          bool exists = lstat(path.c_str(), &info) == 0;
+          if (exists && only_dirs) {
+            exists = stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+          }
+          if (exists) {
+            addMatch(path, "", only_dirs ? "/" : "", out, starts);
+          }
+        }
+      }
+      else {
+        for (size_t d = 0; d < dirs.size(); d++) {
+          const DirListing & listing = list(dirs[d]);
+          size_t offset = 0;
+          while (const struct dirent64 * entry = listing.next(offset)) {
+            if (isHiddenFrom(entry->d_name, part) ||
+                !matchPattern(part, part + length, entry->d_name)) {
+              continue;
+            }
+            bool need_dir = !last || only_dirs;
+            if (need_dir && !isDirEntry(dirs[d], entry, true)) {
+              continue;
+            }
+            if (last) {
+              addMatch(dirs[d], entry->d_name, only_dirs ? "/" : "", out, starts);
+            }
+            else {
+              next_dirs.push_back(dirs[d] + entry->d_name + "/");
+            }
+          }
+        }
+      }
+      dirs.swap(next_dirs);
+    }
+
+    // same order as ls in C locale, libc's sort is optimized even when the shell is not
+    if (starts.size() - first > 1) {
+      qsort_r(&starts[first], starts.size() - first, sizeof(size_t), compareMatches, &out);
+    }
+    return starts.size() - first;
+  }
+
+ private:
+  static int compareMatches(const void * a, const void * b, void * out) {
+    const char * names = static_cast<std::string *>(out)->c_str();
+    return std::strcmp(names + *static_cast<const size_t *>(a), names + *static_cast<const size_t *>(b));
+  }
+
+  /*
+    Append dir, name and tail as one match.
+  */
+  static void addMatch(const std::string & dir,
+                       const char * name,
+                       const char * tail,
+                       std::string & out,
+                       std::vector<size_t> & starts) {
+    starts.push_back(out.size());
+    out += dir;
+    out += name;
+    out += tail;
+    out += '\0';
+  }
+
+  /*
+    Get entries of directory dir, "" for current one, reading it only the first time in a line.
+  */
+  const DirListing & list(const std::string & dir) {
+    std::unordered_map<std::string, DirListing>::iterator it = listings.find(dir);
+    if (it != listings.end()) {
+      return it->second;
+    }
+    DirListing & listing = listings[dir];
+    listing.read(dir, scratch);
+    return listing;
+  }
+
+  /*
+    Take every directory under dir that isn't hidden from entries and queue them in found.
+  */
+  static void subdirs(const std::string & dir,
+                      const DirListing & listing,
+                      std::deque<std::string> & found) {
+    size_t offset = 0;
+    while (const struct dirent64 * entry = listing.next(offset)) {
+      if (!isHiddenFrom(entry->d_name, "*") && isDirEntry(dir, entry, false)) {
+        found.push_back(dir + entry->d_name + "/");
+      }
+    }
+  }
+
+  /*
+    Add every directory under base to found, not hidden ones and not through symbolic links.
+    Each one read is kept, so matching the rest of the pattern doesn't read it again.
+    Starts alone, and when GLOB_PARALLEL_DIRS directories are waiting it goes on with threads.
+  */
+  void walk(const std::string & base, std::vector<std::string> & found) {
+    std::deque<std::string> queue;
+    queue.push_back(base);
+    bool first = true;
+    while (!queue.empty() && queue.size() < GLOB_PARALLEL_DIRS) {
+      std::string dir = queue.front();
+      queue.pop_front();
+      if (!first) {
+        found.push_back(dir);
+      }
+      first = false;
+      subdirs(dir, list(dir), queue);
+    }
+    if (queue.empty()) {
+      return;
+    }
+
+    // big tree: threads take directories from queue and put what they find back in it
+    std::mutex lock;
+    std::condition_variable changed;
+    size_t busy = 0;  // threads reading a directory, which may queue more
+    std::vector<std::pair<std::string, DirListing>> read;
+    unsigned cores = std::thread::hardware_concurrency();
+    size_t count = std::max(1u, std::min(cores, (unsigned)GLOB_MAX_THREADS));
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < count; t++) {
+      threads.push_back(std::thread([&]() {
+        std::vector<char> own_scratch;
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+          changed.wait(guard, [&]() { return !queue.empty() || busy == 0; });
+          if (queue.empty()) {
+            return;
+          }
+          std::string dir = queue.front();
+          queue.pop_front();
+          busy++;
+          guard.unlock();
+
+          DirListing listing;
+          listing.read(dir, own_scratch);
+          std::deque<std::string> more;
+          subdirs(dir, listing, more);
+
+          guard.lock();
+          queue.insert(queue.end(), more.begin(), more.end());
+          found.push_back(dir);
+          read.push_back(std::make_pair(dir, DirListing()));
+          read.back().second.entries.swap(listing.entries);
+          read.back().second.opened = listing.opened;
+          busy--;
+          changed.notify_all();
+        }
+      }));
+    }
+    for (size_t t = 0; t < threads.size(); t++) {
+      threads[t].join();
+    }
+    for (size_t k = 0; k < read.size(); k++) {
+      DirListing & listing = listings[read[k].first];
+      listing.entries.swap(read[k].second.entries);
+      listing.opened = read[k].second.opened;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,374 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define HISTORY_FILE ".myshell_history" /* history file in home directory */
+#define HISTORY_BLOCK_BYTES 32768        /* lines of history file indexed together */
+#define HISTORY_BLOCK_BITS 32768         /* bits of trigram set of one block */
+
+/* Part of history file with the set of every trigram its lines have */
+struct HistoryBlock {
+  size_t start;                                 // offset of first line in file
+  size_t end;                                   // offset after last line's '\n'
+  uint64_t trigrams[HISTORY_BLOCK_BITS / 64];   // bit of hash of each trigram in block's lines
+};
+
+/*
+  Get bit of trigram starting at text.
+*/
+size_t trigramBit(const char * text) {
+  unsigned hash = static_cast<unsigned char>(text[0]) * 65599u * 65599u +
+                  static_cast<unsigned char>(text[1]) * 65599u +
+                  static_cast<unsigned char>(text[2]);
+  return (hash ^ (hash >> 15)) % HISTORY_BLOCK_BITS;
+}
+
+/*
+  Class for command history kept in a file shared by every shell of the user, one line per
+  command. Each line is appended with a single write() on an O_APPEND descriptor, so lines of
+  shells running at once never mix. Nothing is read when the shell starts. The file is mapped
+  into memory the first time history is looked at, and mapped again longer when it grew.
+  Searching uses an index of blocks of 32 KB of lines, each with the set of trigrams its lines
+  have as bits. Blocks are indexed newest first, only as far back as a search goes, and new
+  lines are added to the index as they are searched. Only blocks having every trigram of the
+  searched text are scanned, so searching again skips most of years of history.
+*/
+class History
+{
+ private:
+  std::string path;                  // history file, empty when there's no history
+  int append_fd;                     // descriptor lines are appended to, -1 until first line
+  int read_fd;                       // descriptor file is mapped from, -1 until first look
+  const char * map;                  // file mapped read only, nullptr when nothing is mapped
+  size_t mapped;                     // bytes mapped
+  dev_t device;                      // device of file read_fd is open on
+  ino_t inode;                       // inode of file read_fd is open on
+  std::deque<HistoryBlock> blocks;   // index of complete lines, oldest first
+  size_t oldest;                     // offset index starts at, npos before first search
+  size_t newest;                     // offset index reaches, always after a '\n'
+
+ public:
+  History() :
+      path(),
+      append_fd(-1),
+      read_fd(-1),
+      map(nullptr),
+      mapped(0),
+      device(0),
+      inode(0),
+      blocks(),
+      oldest(std::string::npos),
+      newest(0) {}
+
+  ~History() {
+    unmap();
+    if (append_fd != -1) {
+      close(append_fd);
+    }
+    if (read_fd != -1) {
+      close(read_fd);
+    }
+  }
+
+  /*
+    Use MYSHELL_HISTORY as history file, or HISTORY_FILE in home directory.
+    Without either there is no history.
+  */
+  void setFile() {
+    const char * file = getenv("MYSHELL_HISTORY");
+    const char * home = getenv("HOME");
+    if (file != nullptr && file[0] != 0) {
+      path = file;
+    }
+    else if (home != nullptr && home[0] != 0) {
+      path = std::string(home) + "/" + HISTORY_FILE;
+    }
+  }
+
+  /*
+    Append line typed by user to history file. Blank lines are not kept. If the file was
+    replaced, like by log rotation, the new one is opened.
+  */
+  void add(const std::string & line) {
+    if (path.empty() || line.find_first_not_of(' ') == std::string::npos ||
+        line.find('\n') != std::string::npos) {
+      return;
+    }
+    struct stat info;
+    struct stat opened;
+    if (append_fd != -1 && (stat(path.c_str(), &info) == -1 || fstat(append_fd, &opened) == -1 ||
+                            info.st_ino != opened.st_ino || info.st_dev != opened.st_dev)) {
+      close(append_fd);
+      append_fd = -1;
+    }
+    if (append_fd == -1) {
+      append_fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+      if (append_fd == -1) {
+        path.clear();  // don't try for every line
+        return;
+      }
+    }
+    std::string record = line + "\n";
+    ssize_t len;
+    while ((len = write(append_fd, record.data(), record.size())) == -1 && errno == EINTR) {
+    }
+  }
+
+  /*
+    Get line before the one starting at pos, npos for the last one.
+    Return false if there's none.
+  */
+  bool previous(size_t & pos, std::string & line) {
+    if (pos == std::string::npos) {
+      refresh();
+      pos = complete();
+    }
+    if (pos == 0 || map == nullptr) {
+      return false;
+    }
+    size_t start = lineStart(pos - 1);
+    line.assign(map + start, pos - 1 - start);
+    pos = start;
+    return true;
+  }
+
+  /*
+    Get line after the one starting at pos. Return false if pos is the last line.
+  */
+  bool next(size_t & pos, std::string & line) {
+    if (map == nullptr || pos >= complete()) {
+      return false;
+    }
+    const char * end = static_cast<const char *>(std::memchr(map + pos, '\n', complete() - pos));
+    size_t after = end - map + 1;
+    if (after >= complete()) {
+      return false;
+    }
+    end = static_cast<const char *>(std::memchr(map + after, '\n', complete() - after));
+    line.assign(map + after, end - map - after);
+    pos = after;
+    return true;
+  }
+
+  /*
+    Find newest line having text that starts before pos, npos to search all of history.
+    Return offset of line, npos if none has text.
+  */
+  size_t search(const std::string & text, size_t pos, std::string & line) {
+    if (pos == std::string::npos) {
+      refresh();
+      pos = complete();
+    }
+    indexNewer();
+
+    // older blocks are indexed when search reaches them
+    for (size_t b = blocks.size(); b > 0 || oldest > 0; b--) {
+      if (b == 0) {
+        indexOlder();
+        b = 1;
+      }
+      const HistoryBlock & block = blocks[b - 1];
+      if (block.start >= pos || !mayHave(block, text)) {
+        continue;
+      }
+      // newest line of block first
+      size_t end = std::min(block.end, pos);
+      while (end > block.start) {
+        size_t start = lineStart(end - 1);
+        if (memmem(map + start, end - 1 - start, text.data(), text.size()) != nullptr) {
+          line.assign(map + start, end - 1 - start);
+          return start;
+        }
+        end = start;
+      }
+    }
+    return std::string::npos;
+  }
+
+  /*
+    Print last count lines of history with their numbers, every line when count is -1.
+  */
+  void print(std::ostream & out, long count) {
+    refresh();
+    size_t end = complete();
+
+    // go back count lines from the end, then count lines before to number them
+    size_t pos = end;
+    for (long n = 0; pos > 0 && (count < 0 || n < count); n++) {
+      pos = lineStart(pos - 1);
+    }
+    size_t number = 1;
+    for (size_t at = 0; at < pos; number++) {
+      at = static_cast<const char *>(std::memchr(map + at, '\n', pos - at)) - map + 1;
+    }
+
+    char label[32];
+    while (pos < end) {
+      const char * stop = static_cast<const char *>(std::memchr(map + pos, '\n', end - pos));
+      snprintf(label, sizeof(label), "%5zu  ", number++);
+      out << label;
+      out.write(map + pos, stop - map - pos);
+      out << '\n';
+      pos = stop - map + 1;
+    }
+  }
+
+ private:
+  /*
+    Map file again if it grew since last time. If it got shorter or was replaced, the old
+    mapping would fault past the new end, so the file is opened again and indexed from nothing.
+  */
+  void refresh() {
+    if (path.empty()) {
+      return;
+    }
+    struct stat info;
+    if (read_fd != -1 && (stat(path.c_str(), &info) == -1 || info.st_ino != inode ||
+                          info.st_dev != device || (size_t)info.st_size < mapped)) {
+      forget();
+    }
+    if (read_fd == -1) {
+      read_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (read_fd == -1) {
+        return;
+      }
+    }
+    if (fstat(read_fd, &info) == -1) {
+      return;
+    }
+    device = info.st_dev;
+    inode = info.st_ino;
+    if ((size_t)info.st_size <= mapped) {
+      return;
+    }
+    unmap();
+    void * got = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, read_fd, 0);
+    if (got == MAP_FAILED) {
+      return;
+    }
+    map = static_cast<const char *>(got);
+    mapped = info.st_size;
+  }
+
+  /*
+    Close file and drop its mapping and index.
+  */
+  void forget() {
+    unmap();
+    close(read_fd);
+    read_fd = -1;
+    blocks.clear();
+    oldest = std::string::npos;
+    newest = 0;
+  }
+
+  void unmap() {
+    if (map != nullptr) {
+      munmap(const_cast<char *>(map), mapped);
+      map = nullptr;
+      mapped = 0;
+    }
+  }
+
+  /*
+    Get offset after last complete line, a line another shell is writing is left out.
+  */
+  size_t complete() const {
+    if (map == nullptr) {
+      return 0;
+    }
+    const char * last = static_cast<const char *>(memrchr(map, '\n', mapped));
+    return last == nullptr ? 0 : last - map + 1;
+  }
+
+  /*
+    Get offset of line having byte at pos.
+  */
+  size_t lineStart(size_t pos) const {
+    const char * before = pos == 0 ? nullptr : static_cast<const char *>(memrchr(map, '\n', pos));
+    return before == nullptr ? 0 : before - map + 1;
+  }
+
+  /*
+    Set bit of every trigram inside lines of block, none across '\n'.
+  */
+  void addTrigrams(HistoryBlock & block) const {
+    for (size_t i = block.start; i + 2 < block.end; i++) {
+      if (map[i] != '\n' && map[i + 1] != '\n' && map[i + 2] != '\n') {
+        size_t bit = trigramBit(map + i);
+        block.trigrams[bit / 64] |= uint64_t(1) << (bit % 64);
+      }
+    }
+  }
+
+  /*
+    Add complete lines after newest to index, in blocks of about HISTORY_BLOCK_BYTES.
+    On first search, index starts empty at the end of history.
+  */
+  void indexNewer() {
+    size_t end = complete();
+    if (oldest == std::string::npos) {
+      oldest = newest = end;
+    }
+    while (newest < end) {
+      HistoryBlock block = HistoryBlock();
+      block.start = newest;
+      size_t limit = std::min(end, newest + HISTORY_BLOCK_BYTES);
+      const char * stop =
+          static_cast<const char *>(std::memchr(map + limit - 1, '\n', end - limit + 1));
+      block.end = stop - map + 1;
+
+      // last block grows until it's full
+      if (!blocks.empty() && blocks.back().end - blocks.back().start < HISTORY_BLOCK_BYTES) {
+        block = blocks.back();
+        block.end = stop - map + 1;
+        blocks.pop_back();
+      }
+      addTrigrams(block);
+      blocks.push_back(block);
+      newest = block.end;
+    }
+  }
+
+  /*
+    Add block of about HISTORY_BLOCK_BYTES of lines before oldest to index.
+  */
+  void indexOlder() {
+    HistoryBlock block = HistoryBlock();
+    block.end = oldest;
+    block.start = oldest > HISTORY_BLOCK_BYTES ? lineStart(oldest - HISTORY_BLOCK_BYTES) : 0;
+    addTrigrams(block);
+    blocks.push_front(block);
+    oldest = block.start;
+  }
+
+  /*
+    Check whether block may have a line with text, false only if it surely has none.
+  */
+  static bool mayHave(const HistoryBlock & block, const std::string & text) {
+    for (size_t i = 0; i + 2 < text.size(); i++) {
+      size_t bit = trigramBit(text.data() + i);
+      if (!(block.trigrams[bit / 64] & (uint64_t(1) << (bit % 64)))) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+#endif
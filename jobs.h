@@ -0,0 +1,503 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "accounting.h"
+#include "statusstream.h"
+
+/* One process of a job */
+struct JobProcess {
+  pid_t pid;            // pid of process
+  std::string name;     // argv[0] of process, for status records
+  int status;           // last status got from wait4()
+  bool done;            // whether it terminated
+  bool stopped;         // whether it is stopped now
+  struct rusage usage;  // resources it used, valid when done
+  double ended;         // monotonic time it terminated, in seconds
+
+  explicit JobProcess(pid_t curt_pid) :
+      pid(curt_pid),
+      name(),
+      status(0),
+      done(false),
+      stopped(false),
+      ended(0) {
+    std::memset(&usage, 0, sizeof(usage));
+  }
+};
+
+/* Processes started by one input line, a single command or a pipeline */
+struct Job {
+  int id;                          // job number shown as [id]
+  pid_t pgid;                      // process group of job, 0 when job control is off
+  std::string command;             // input line, for listing
+  std::vector<JobProcess> procs;   // every process of job, in pipeline order
+  bool background;                 // whether shell runs it in background
+  bool has_tmodes;                 // whether tmodes was saved when job stopped
+  struct termios tmodes;           // terminal modes of job when it stopped
+  bool timed;                      // whether resources are reported when it finishes, by "time"
+  double started;                  // monotonic time job started, in seconds
+  double ended;                    // monotonic time last process terminated, in seconds
+
+  Job() :
+      id(0),
+      pgid(0),
+      command(),
+      procs(),
+      background(false),
+      has_tmodes(false),
+      timed(false),
+      started(0),
+      ended(0) {
+    std::memset(&tmodes, 0, sizeof(tmodes));
+  }
+
+  /*
+    Check every process terminated.
+  */
+  bool finished() const {
+    for (size_t i = 0; i < procs.size(); i++) {
+      if (!procs[i].done)
+        return false;
+    }
+    return true;
+  }
+
+  /*
+    Check job cannot go on: every process terminated or stopped, and at least one stopped.
+  */
+  bool stopped() const {
+    bool any_stopped = false;
+    for (size_t i = 0; i < procs.size(); i++) {
+      if (!procs[i].done && !procs[i].stopped)
+        return false;
+      if (procs[i].stopped)
+        any_stopped = true;
+    }
+    return any_stopped;
+  }
+
+  /*
+    Status of the last process, which is the status of the whole job.
+  */
+  int lastStatus() const { return procs.back().status; }
+
+  /*
+    Describe state of job for "jobs" and notices.
+  */
+  std::string state() const {
+    if (stopped())
+      return "Stopped";
+    if (!finished())
+      return "Running";
+    int wstatus = lastStatus();
+    if (WIFSIGNALED(wstatus))
+      return "Killed by signal " + std::to_string(WTERMSIG(wstatus));
+    if (WEXITSTATUS(wstatus) != 0)
+      return "Exit " + std::to_string(WEXITSTATUS(wstatus));
+    return "Done";
+  }
+};
+
+/* Class for all jobs of shell, children are reaped whenever SIGCHLD arrives */
+class JobTable
+{
+ private:
+  std::list<Job> jobs;  // all jobs not reported finished yet, list keeps references valid
+  std::unordered_map<pid_t, JobProcess> unclaimed;  // terminated children not in any job
+  UsageLog usage_log;           // resources used by finished jobs
+  int signal_fd;                // signalfd reading SIGCHLD, which stays blocked otherwise
+  bool job_control;             // whether jobs get own process group and terminal
+  pid_t shell_pgid;             // process group of shell itself
+  struct termios shell_tmodes;  // terminal modes of shell, put back after each job
+
+ public:
+  JobTable() : jobs(), unclaimed(), usage_log(), signal_fd(-1), job_control(false), shell_pgid(0) {
+    std::memset(&shell_tmodes, 0, sizeof(shell_tmodes));
+  }
+
+  /*
+    Block SIGCHLD and read it from a signalfd instead, so children are reaped only
+    when something happened. With interactive terminal, also take control of it.
+  */
+  void init(bool interactive) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (signal_fd == -1) {
+      std::cerr << "signalfd: " << std::strerror(errno) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    job_control = interactive && isatty(STDIN_FILENO);
+    if (!job_control) {
+      return;
+    }
+
+    // wait until shell is in foreground, then get its own process group
+    while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp())) {
+      kill(-shell_pgid, SIGTTIN);
+    }
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+    shell_pgid = getpid();
+    if (getpgrp() != shell_pgid && setpgid(shell_pgid, shell_pgid) == -1) {
+      job_control = false;
+      return;
+    }
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    tcgetattr(STDIN_FILENO, &shell_tmodes);
+  }
+
+  bool jobControl() const { return job_control; }
+
+  /*
+    Give up job control in a forked copy of shell, programs it starts stay in its group.
+  */
+  void leaveJobControl() { job_control = false; }
+  int signalFd() const { return signal_fd; }
+  UsageLog & usageLog() { return usage_log; }
+
+  /*
+    Add a started job, return reference to it.
+    Resources it used are printed when it finishes if it's timed.
+  */
+  Job & add(pid_t pgid,
+            const std::string & command,
+            const std::vector<pid_t> & pids,
+            bool background,
+            bool timed = false) {
+    Job job;
+    job.id = jobs.empty() ? 1 : jobs.back().id + 1;
+    job.pgid = pgid;
+    job.command = command;
+    job.background = background;
+    job.timed = timed;
+    job.started = monotonicSeconds();
+    for (size_t i = 0; i < pids.size(); i++) {
+      job.procs.push_back(JobProcess(pids[i]));
+    }
+    jobs.push_back(job);
+    return jobs.back();
+  }
+
+  /*
+    Find job by number, nullptr if not exists.
+  */
+  Job * find(int id) {
+    for (std::list<Job>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+      if (it->id == id)
+        return &*it;
+    }
+    return nullptr;
+  }
+
+  /*
+    Find job by "%n", "n" or pid of one of its processes, latest job if spec is nullptr.
+  */
+  Job * find(const char * spec) {
+    if (spec == nullptr) {
+      return jobs.empty() ? nullptr : &jobs.back();
+    }
+    if (spec[0] == '%') {
+      return find(atoi(spec + 1));
+    }
+    pid_t pid = atoi(spec);
+    for (std::list<Job>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+      for (size_t i = 0; i < it->procs.size(); i++) {
+        if (it->procs[i].pid == pid)
+          return &*it;
+      }
+    }
+    return find(atoi(spec));
+  }
+
+  /*
+    Get terminated child that belongs to no job, like those started by "parallel".
+    Return false if it has not terminated yet.
+  */
+  bool claim(pid_t pid, JobProcess & proc) {
+    std::unordered_map<pid_t, JobProcess>::iterator it = unclaimed.find(pid);
+    if (it == unclaimed.end())
+      return false;
+    proc = it->second;
+    unclaimed.erase(it);
+    return true;
+  }
+
+  /*
+    Record a claimed child that ran as command but in no job, started at monotonic time started,
+    like a finished job: resources to usage log and a status record.
+  */
+  void recordProcess(const std::string & command, const JobProcess & proc, double started) {
+    Job job;
+    job.command = command;
+    job.procs.push_back(proc);
+    job.started = started;
+    job.ended = proc.ended;
+    recordUsage(job);
+  }
+
+  /*
+    Numbers of all background jobs.
+  */
+  std::vector<int> backgroundIds() const {
+    std::vector<int> ids;
+    for (std::list<Job>::const_iterator it = jobs.begin(); it != jobs.end(); ++it) {
+      if (it->background)
+        ids.push_back(it->id);
+    }
+    return ids;
+  }
+
+  /*
+    Forget a job, resources it used are kept if it finished.
+  */
+  void remove(Job & job) {
+    for (std::list<Job>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+      if (&*it == &job) {
+        if (job.finished()) {
+          recordUsage(job);
+        }
+        jobs.erase(it);
+        return;
+      }
+    }
+  }
+
+  /*
+    Collect every child that changed state, without blocking.
+  */
+  void reap() {
+    // drain signalfd so it's readable again only for new SIGCHLD,
+    // nothing to read means no child changed since last time
+    struct signalfd_siginfo info;
+    bool signaled = false;
+    while (read(signal_fd, &info, sizeof(info)) > 0) {
+      signaled = true;
+    }
+    if (!signaled) {
+      return;
+    }
+
+    int wstatus;
+    struct rusage usage;
+    pid_t pid;
+    while ((pid = wait4(-1, &wstatus, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+      update(pid, wstatus, usage);
+    }
+  }
+
+  /*
+    Block until at least one SIGCHLD arrives, then collect children.
+    Status records waiting to be written are written if the wait is long.
+  */
+  void waitEvent() {
+    struct pollfd pfd;
+    pfd.fd = signal_fd;
+    pfd.events = POLLIN;
+    int ready;
+    while ((ready = poll(&pfd, 1, status_stream.flushTimeout())) == -1 && errno == EINTR) {
+    }
+    if (ready == 0) {
+      status_stream.flush();
+      while (poll(&pfd, 1, -1) == -1 && errno == EINTR) {
+      }
+    }
+    reap();
+  }
+
+  /*
+    Wait for job in foreground until it finishes or stops.
+    Return true if it finished, false if it stopped and is now in background.
+  */
+  bool waitForeground(Job & job) {
+    job.background = false;
+    if (job_control && job.pgid != 0) {
+      tcsetpgrp(STDIN_FILENO, job.pgid);
+    }
+
+    reap();
+    while (!job.finished() && !job.stopped()) {
+      waitEvent();
+    }
+
+    // shell gets terminal back with its own modes
+    if (job_control && job.pgid != 0) {
+      tcsetpgrp(STDIN_FILENO, shell_pgid);
+      if (job.stopped()) {
+        tcgetattr(STDIN_FILENO, &job.tmodes);
+        job.has_tmodes = true;
+      }
+      tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+    }
+
+    if (job.stopped()) {
+      job.background = true;
+      reportOutput() << "\n[" << job.id << "]  " << std::left << std::setw(24) << job.state()
+                     << job.command << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  /*
+    Let a stopped job run again, in foreground or background.
+  */
+  void continueJob(Job & job, bool foreground) {
+    if (foreground && job_control && job.pgid != 0 && job.has_tmodes) {
+      tcsetattr(STDIN_FILENO, TCSADRAIN, &job.tmodes);
+    }
+    for (size_t i = 0; i < job.procs.size(); i++) {
+      job.procs[i].stopped = false;
+    }
+    if (job.pgid != 0) {
+      kill(-job.pgid, SIGCONT);
+    }
+    else {
+      for (size_t i = 0; i < job.procs.size(); i++) {
+        if (!job.procs[i].done)
+          kill(job.procs[i].pid, SIGCONT);
+      }
+    }
+    job.background = !foreground;
+  }
+
+  /*
+    Print every background job that finished since last time and forget them.
+  */
+  void notify(bool print) {
+    reap();
+    std::list<Job>::iterator it = jobs.begin();
+    while (it != jobs.end()) {
+      if (it->background && it->finished()) {
+        if (print) {
+          printJob(*it);
+        }
+        recordUsage(*it);
+        it = jobs.erase(it);
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+
+  /*
+    Print all jobs for "jobs", finished ones are forgotten after shown.
+  */
+  void list() {
+    reap();
+    for (std::list<Job>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+      printJob(*it);
+    }
+    notify(false);
+  }
+
+  /*
+    Stopped jobs would stay forever after shell exits, hang them up.
+  */
+  void hangUpStopped() {
+    for (std::list<Job>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+      if (it->stopped()) {
+        for (size_t i = 0; i < it->procs.size(); i++) {
+          kill(it->procs[i].pid, SIGHUP);
+        }
+        continueJob(*it, false);
+      }
+    }
+  }
+
+ private:
+  /*
+    Record new state of one child in its job.
+  */
+  void update(pid_t pid, int wstatus, struct rusage & usage) {
+    for (std::list<Job>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+      for (size_t i = 0; i < it->procs.size(); i++) {
+        JobProcess & proc = it->procs[i];
+        if (proc.pid != pid)
+          continue;
+        if (WIFSTOPPED(wstatus)) {
+          proc.stopped = true;
+        }
+        else if (WIFCONTINUED(wstatus)) {
+          proc.stopped = false;
+        }
+        else {
+          proc.status = wstatus;
+          proc.done = true;
+          proc.stopped = false;
+          proc.usage = usage;
+          proc.ended = monotonicSeconds();
+          if (it->finished()) {
+            it->ended = proc.ended;
+          }
+        }
+        return;
+      }
+    }
+
+    // not in any job, keep it until someone claims it
+    if (WIFEXITED(wstatus) || WIFSIGNALED(wstatus)) {
+      JobProcess proc(pid);
+      proc.status = wstatus;
+      proc.done = true;
+      proc.usage = usage;
+      proc.ended = monotonicSeconds();
+      unclaimed.insert(std::make_pair(pid, proc));
+    }
+  }
+
+  /*
+    Add resources used by every process of a finished job to usage log, and a status record
+    of each process to status stream.
+  */
+  void recordUsage(Job & job) {
+    CommandUsage usage(job.command, job.ended - job.started);
+    for (size_t i = 0; i < job.procs.size(); i++) {
+      const JobProcess & proc = job.procs[i];
+      usage.add(proc.usage);
+      status_stream.add(job.id,
+                        proc.pid,
+                        proc.name,
+                        proc.status,
+                        job.started,
+                        proc.ended - job.started,
+                        proc.usage);
+    }
+    usage_log.record(usage, job.timed);
+  }
+
+  /*
+    Print one line for job like "[1]  Done    sleep 1".
+  */
+  void printJob(Job & job) {
+    reportOutput() << "[" << job.id << "]  " << std::left << std::setw(24) << job.state()
+                   << job.command << std::endl;
+  }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cstdio>
+#include <string>
+
+/*
+  Get length of the valid UTF-8 sequence starting at text[i], 0 if the bytes there are not one.
+  Overlong forms, surrogates and code points past U+10FFFF are not valid.
+*/
+size_t utf8Length(const std::string & text, size_t i) {
+  unsigned char c = text[i];
+  size_t length;
+  unsigned char low = 0x80;   // smallest second byte allowed
+  unsigned char high = 0xbf;  // biggest second byte allowed
+  if (c >= 0xc2 && c <= 0xdf) {
+    length = 2;
+  }
+  else if (c >= 0xe0 && c <= 0xef) {
+    length = 3;
+    low = c == 0xe0 ? 0xa0 : 0x80;
+    high = c == 0xed ? 0x9f : 0xbf;
+  }
+  else if (c >= 0xf0 && c <= 0xf4) {
+    length = 4;
+    low = c == 0xf0 ? 0x90 : 0x80;
+    high = c == 0xf4 ? 0x8f : 0xbf;
+  }
+  else {
+    return 0;
+  }
+  if (i + length > text.size()) {
+    return 0;
+  }
+  for (size_t k = 1; k < length; k++) {
+    unsigned char next = text[i + k];
+    if (next < (k == 1 ? low : 0x80) || next > (k == 1 ? high : 0xbf)) {
+      return 0;
+    }
+  }
+  return length;
+}
+
+/*
+  Append text as JSON string with quotes, escaping '"', '\' and control characters. Valid UTF-8
+  is copied as it is, any other byte of 0x80 or more becomes "\u00XX" so the output is always
+  valid JSON.
+*/
+void appendJsonString(std::string & out, const std::string & text) {
+  out += '"';
+  size_t i = 0;
+  while (i < text.size()) {
+    unsigned char c = text[i];
+    size_t length = c < 0x80 ? 1 : utf8Length(text, i);
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    }
+    else if (c < 0x20 || length == 0) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    }
+    else {
+      out.append(text, i, length);
+    }
+    i += length == 0 ? 1 : length;
+  }
+  out += '"';
+}
+
+#endif
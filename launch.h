@@ -0,0 +1,588 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* Different ways to start a program */
+enum LaunchMode {
+  LAUNCH_SPAWN,  // posix_spawn(), child shares parent's memory until exec
+  LAUNCH_FORK,   // plain fork() + execve(), copies page tables of parent
+  LAUNCH_SERVER  // small helper forked at startup starts programs for the shell
+};
+
+#define SERVER_MAX_FDS 16 /* descriptors passed with one request to fork server */
+#define SERVER_CWD 3      /* position of shell's current directory among passed descriptors */
+
+/* One change of file descriptors child does before exec, dup2(from, fd) or open(path) onto fd */
+struct FdAction {
+  int fd;            // descriptor child will use
+  int from;          // descriptor of parent copied onto fd, -1 when path is opened instead
+  std::string path;  // file opened onto fd
+  int flags;         // flags to open path
+
+  FdAction(int curt_fd, int curt_from) : fd(curt_fd), from(curt_from), path(), flags(0) {}
+  FdAction(int curt_fd, const std::string & curt_path, int curt_flags) :
+      fd(curt_fd),
+      from(-1),
+      path(curt_path),
+      flags(curt_flags) {}
+};
+
+/* Everything needed to start one program, all prepared by the parent */
+struct LaunchSpec {
+  std::string path;               // absolute path of program
+  std::vector<char *> args;       // arguments passed to program, ends with nullptr
+  char ** envp;                   // environment variables, ends with nullptr
+  int fail_status;                // exit status of child when exec fails in fork mode
+  std::vector<FdAction> actions;  // descriptor changes, done in order
+  pid_t pgid;                     // process group to join, 0 for a new one, -1 to keep shell's
+  bool foreground;                // group takes the terminal as soon as child joins it
+
+  LaunchSpec() :
+      path(),
+      args(),
+      envp(nullptr),
+      fail_status(EXIT_FAILURE),
+      actions(),
+      pgid(-1),
+      foreground(false) {}
+};
+
+// signals shell may ignore or block for itself, child always gets them back to default
+const int CHILD_DEFAULT_SIGNALS[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE};
+
+/*
+  Prepare signals and process group in a forked child, like spawn does before exec. A foreground
+  child gives terminal to its group itself, while SIGTTOU is still ignored, so it never reads
+  terminal before shell has done the same.
+*/
+void prepareChild(pid_t pgid, bool foreground) {
+  if (pgid != -1) {
+    setpgid(0, pgid);
+    if (foreground) {
+      tcsetpgrp(STDIN_FILENO, pgid == 0 ? getpid() : pgid);
+    }
+  }
+  for (size_t i = 0; i < sizeof(CHILD_DEFAULT_SIGNALS) / sizeof(int); i++) {
+    signal(CHILD_DEFAULT_SIGNALS[i], SIG_DFL);
+  }
+  sigset_t empty;
+  sigemptyset(&empty);
+  sigprocmask(SIG_SETMASK, &empty, nullptr);
+}
+
+/*
+  Apply one descriptor change in current process, return false if it fails.
+*/
+bool applyFdAction(FdAction & action) {
+  if (action.from != -1) { /* copy descriptor */
+    return dup2(action.from, action.fd) != -1;
+  }
+
+  // open file with close-on-exec, only the copy on action.fd survives exec
+  int opened = open(action.path.c_str(), action.flags | O_CLOEXEC, 0666);
+  if (opened == -1) {
+    std::cerr << action.path << ": " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  if (opened == action.fd) { /* got the wanted descriptor directly */
+    return fcntl(opened, F_SETFD, 0) != -1;
+  }
+  bool ok = dup2(opened, action.fd) != -1;
+  close(opened);
+  return ok;
+}
+
+/*
+  Apply descriptor changes in a forked child, return false if any of them fails.
+*/
+bool applyFdActions(std::vector<FdAction> & actions) {
+  for (size_t i = 0; i < actions.size(); i++) {
+    if (!applyFdAction(actions[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+  Apply descriptor changes in the shell itself, for built-in instructions.
+  Old descriptors are stored in saved so restoreFds() can put them back.
+*/
+bool redirectFds(std::vector<FdAction> & actions, std::vector<FdAction> & saved) {
+  std::cout.flush();
+  for (size_t i = 0; i < actions.size(); i++) {
+    // keep a copy of old descriptor, -1 if it was not open
+    int copy = fcntl(actions[i].fd, F_DUPFD_CLOEXEC, 10);
+    saved.push_back(FdAction(actions[i].fd, copy));
+
+    if (!applyFdAction(actions[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+  Put back descriptors saved by redirectFds(), in reverse order.
+*/
+void restoreFds(std::vector<FdAction> & saved) {
+  std::cout.flush();
+  for (size_t i = saved.size(); i > 0; i--) {
+    FdAction & old = saved[i - 1];
+    if (old.from == -1) {
+      close(old.fd);
+    }
+    else {
+      dup2(old.from, old.fd);
+      close(old.from);
+    }
+  }
+  saved.clear();
+}
+
+/*
+  Start program with posix_spawn(), no address space is copied.
+  Return pid of child, or -1 with errno set.
+*/
+pid_t spawnProgram(LaunchSpec & spec) {
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+
+  // child starts with nothing blocked and default signals, whatever the shell does for itself
+  sigset_t empty;
+  sigemptyset(&empty);
+  posix_spawnattr_setsigmask(&attr, &empty);
+  sigset_t defaults;
+  sigemptyset(&defaults);
+  for (size_t i = 0; i < sizeof(CHILD_DEFAULT_SIGNALS) / sizeof(int); i++) {
+    sigaddset(&defaults, CHILD_DEFAULT_SIGNALS[i]);
+  }
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+  if (spec.pgid != -1) {
+    posix_spawnattr_setpgroup(&attr, spec.pgid);
+    flags |= POSIX_SPAWN_SETPGROUP;
+  }
+  posix_spawnattr_setflags(&attr, flags);
+
+  // descriptors are set up in child between spawn and exec
+  posix_spawn_file_actions_t file_actions;
+  posix_spawn_file_actions_init(&file_actions);
+  if (spec.foreground && spec.pgid != -1) { /* group takes terminal before stdin is replaced */
+    posix_spawn_file_actions_addtcsetpgrp_np(&file_actions, STDIN_FILENO);
+  }
+  for (size_t i = 0; i < spec.actions.size(); i++) {
+    FdAction & action = spec.actions[i];
+    if (action.from != -1) {
+      posix_spawn_file_actions_adddup2(&file_actions, action.from, action.fd);
+    }
+    else {
+      posix_spawn_file_actions_addopen(
+          &file_actions, action.fd, action.path.c_str(), action.flags, 0666);
+    }
+  }
+
+  pid_t pid;
+  int err =
+      posix_spawn(&pid, spec.path.c_str(), &file_actions, &attr, &spec.args[0], spec.envp);
+  posix_spawn_file_actions_destroy(&file_actions);
+  posix_spawnattr_destroy(&attr);
+
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return pid;
+}
+
+/*
+  Start program with fork() + execve(), kept for cases spawn cannot handle.
+  Return pid of child, or -1 with errno set.
+*/
+pid_t forkProgram(LaunchSpec & spec) {
+  pid_t pid = fork();
+  if (pid == 0) { /* code excuted by child */
+    prepareChild(spec.pgid, spec.foreground);
+    if (!applyFdActions(spec.actions)) {
+      _exit(EXIT_FAILURE);
+    }
+    execve(spec.path.c_str(), &spec.args[0], spec.envp);
+
+    // don't expect return unless error
+    _exit(spec.fail_status);
+  }
+  if (pid > 0 && spec.pgid != -1) { /* parent sets group too, whoever runs first */
+    setpgid(pid, spec.pgid == 0 ? pid : spec.pgid);
+  }
+  return pid;
+}
+
+/*
+  Class for a fork server: a helper forked when the shell starts, before tables and history grow,
+  so its address space stays small. The shell sends it each resolved program with arguments,
+  environment and descriptors over a socket pair, and the helper starts it with
+  clone(CLONE_PARENT): the program is a child of the shell, which reaps it and controls its
+  process group as usual, but its cost of copying doesn't depend on memory of the shell.
+*/
+class ForkServer
+{
+ private:
+  int sock;     // shell's end of socket pair, -1 when no server runs
+  pid_t pid;    // helper process
+  pid_t owner;  // shell that started helper, forked copies of it don't use it
+
+ public:
+  ForkServer() : sock(-1), pid(-1), owner(-1) {}
+
+  /*
+    Whether this process can send programs to the helper.
+  */
+  bool running() const { return sock != -1 && owner == getpid(); }
+
+  /*
+    Fork the helper. Return false with errno set if it cannot start.
+  */
+  bool start() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) {
+      return false;
+    }
+    std::cout.flush();
+    pid = fork();
+    if (pid == 0) { /* code excuted by helper */
+      close(fds[0]);
+      serve(fds[1]);
+    }
+    int err = errno;
+    close(fds[1]);
+    if (pid == -1) {
+      close(fds[0]);
+      errno = err;
+      return false;
+    }
+    sock = fds[0];
+    owner = getpid();
+    return true;
+  }
+
+  /*
+    Let the helper start program, like spawnProgram(). If the request cannot be sent, like when
+    one of its descriptors is closed, or program needs more than SERVER_MAX_FDS descriptors, spawn
+    it here instead. Only a broken socket stops the helper. Return pid of child, or -1 with errno
+    set.
+  */
+  pid_t launch(LaunchSpec & spec) {
+    // descriptors child starts with: shell's current standard ones and directory, then sources
+    // of dup2
+    int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cwd == -1) {
+      return -1;
+    }
+    std::vector<int> fds;
+    fds.push_back(STDIN_FILENO);
+    fds.push_back(STDOUT_FILENO);
+    fds.push_back(STDERR_FILENO);
+    fds.push_back(cwd);
+
+    // request is a list of strings, each ending with 0
+    std::string request;
+    pid_t pgid = spec.pgid == -1 ? getpgrp() : spec.pgid;  // helper's group may not be shell's
+    put(request, std::to_string(pgid));
+    put(request, std::to_string(spec.fail_status));
+    put(request, spec.path);
+    put(request, std::to_string(spec.args.size() - 1));
+    for (size_t i = 0; spec.args[i] != nullptr; i++) {
+      put(request, spec.args[i]);
+    }
+    size_t env_count = 0;
+    while (spec.envp[env_count] != nullptr) {
+      env_count++;
+    }
+    put(request, std::to_string(env_count));
+    for (size_t i = 0; i < env_count; i++) {
+      put(request, spec.envp[i]);
+    }
+    put(request, std::to_string(spec.actions.size()));
+    for (size_t i = 0; i < spec.actions.size(); i++) {
+      FdAction & action = spec.actions[i];
+      int index = -1;  // position of action.from among passed descriptors
+      if (action.from != -1) {
+        index = fds.size();
+        fds.push_back(action.from);
+      }
+      put(request, std::to_string(action.fd));
+      put(request, std::to_string(index));
+      put(request, std::to_string(action.flags));
+      put(request, action.path);
+    }
+
+    // too many descriptors for one message, only this program is spawned here
+    if (fds.size() > SERVER_MAX_FDS) {
+      close(cwd);
+      return spawnProgram(spec);
+    }
+
+    bool sent = send(request, fds);
+    close(cwd);
+    if (!sent) {
+      return spawnProgram(spec);
+    }
+    int32_t reply[2];  // pid of child, errno when it is -1
+    if (recv(sock, reply, sizeof(reply), MSG_WAITALL) != sizeof(reply)) {
+      stop();
+      return spawnProgram(spec);
+    }
+    if (reply[0] == -1 && reply[1] == EMSGSIZE) { /* helper didn't get every descriptor */
+      return spawnProgram(spec);
+    }
+    if (reply[0] == -1) {
+      errno = reply[1];
+      return -1;
+    }
+    if (spec.pgid != -1) { /* shell is the real parent, it sets group too */
+      setpgid(reply[0], spec.pgid == 0 ? reply[0] : spec.pgid);
+    }
+    return reply[0];
+  }
+
+ private:
+  /*
+    Close socket, the helper sees end of file and exits.
+  */
+  void stop() {
+    close(sock);
+    sock = -1;
+  }
+
+  static void put(std::string & request, const std::string & value) {
+    request.append(value.c_str(), value.size() + 1);
+  }
+
+  /*
+    Take next string of request at pos.
+  */
+  static const char * take(const std::string & request, size_t & pos) {
+    const char * value = request.c_str() + pos;
+    pos = std::min(request.size(), pos + std::strlen(value) + 1);
+    return value;
+  }
+
+  /*
+    Send length of request with descriptors attached, then request itself. Return false if it
+    isn't sent. A request that fails before anything is sent, like for a closed descriptor, leaves
+    the helper running, a broken socket or a request sent in part stops it.
+  */
+  bool send(const std::string & request, const std::vector<int> & fds) {
+    uint32_t size = request.size();
+    struct iovec iov;
+    iov.iov_base = &size;
+    iov.iov_len = sizeof(size);
+    char control[CMSG_SPACE(sizeof(int) * SERVER_MAX_FDS)];
+    std::memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    std::memcpy(CMSG_DATA(cmsg), &fds[0], sizeof(int) * fds.size());
+    ssize_t len = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    if (len == -1 && errno != EPIPE && errno != ECONNRESET) {
+      return false;
+    }
+    if (len != sizeof(size)) {
+      stop();
+      return false;
+    }
+    for (size_t sent = 0; sent < request.size();) {
+      ssize_t n = ::send(sock, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+      if (n == -1 && errno != EINTR) {
+        stop();
+        return false;
+      }
+      sent += n == -1 ? 0 : n;
+    }
+    return true;
+  }
+
+  /*
+    Receive one request and its descriptors in the helper, return false at end of file.
+    If not every descriptor fit, none is kept and fds is left empty.
+  */
+  static bool receive(int sock, std::string & request, std::vector<int> & fds) {
+    uint32_t size;
+    struct iovec iov;
+    iov.iov_base = &size;
+    iov.iov_len = sizeof(size);
+    char control[CMSG_SPACE(sizeof(int) * SERVER_MAX_FDS)];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(size)) {
+      return false;
+    }
+    fds.clear();
+    for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        fds.resize(count);
+        std::memcpy(&fds[0], CMSG_DATA(cmsg), sizeof(int) * count);
+      }
+    }
+    if (msg.msg_flags & MSG_CTRUNC) {
+      for (size_t i = 0; i < fds.size(); i++) {
+        close(fds[i]);
+      }
+      fds.clear();
+    }
+    request.resize(size);
+    return size == 0 || recv(sock, &request[0], size, MSG_WAITALL) == (ssize_t)size;
+  }
+
+  /*
+    Loop of the helper: start every program it is sent until the shell closes its end.
+    The helper never returns to the shell's code and never flushes the shell's buffers.
+  */
+  static void serve(int sock) {
+    // terminal signals are for the shell, the helper only stops when the shell is gone
+    for (size_t i = 0; i < sizeof(CHILD_DEFAULT_SIGNALS) / sizeof(int); i++) {
+      signal(CHILD_DEFAULT_SIGNALS[i], SIG_IGN);
+    }
+    signal(SIGCHLD, SIG_DFL);
+
+    // don't keep the shell's terminal or pipes open, every child gets them from the request
+    int null_fd = open("/dev/null", O_RDWR);
+    for (int fd = STDIN_FILENO; fd <= STDERR_FILENO && null_fd != -1; fd++) {
+      dup2(null_fd, fd);
+    }
+    if (null_fd > STDERR_FILENO) {
+      close(null_fd);
+    }
+
+    std::string request;
+    std::vector<int> fds;
+    std::vector<char *> args;
+    std::vector<char *> envp;
+    std::vector<FdAction> actions;
+    while (receive(sock, request, fds)) {
+      size_t pos = 0;
+      pid_t pgid = atoi(take(request, pos));
+      int fail_status = atoi(take(request, pos));
+      const char * path = take(request, pos);
+      args.clear();
+      for (size_t n = atoi(take(request, pos)); n > 0; n--) {
+        args.push_back(const_cast<char *>(take(request, pos)));
+      }
+      args.push_back(nullptr);
+      envp.clear();
+      for (size_t n = atoi(take(request, pos)); n > 0; n--) {
+        envp.push_back(const_cast<char *>(take(request, pos)));
+      }
+      envp.push_back(nullptr);
+      actions.clear();
+      bool valid = fds.size() > SERVER_CWD;
+      for (size_t n = atoi(take(request, pos)); n > 0; n--) {
+        int fd = atoi(take(request, pos));
+        int index = atoi(take(request, pos));
+        int flags = atoi(take(request, pos));
+        const char * file = take(request, pos);
+        if (index == -1) {
+          actions.push_back(FdAction(fd, file, flags));
+        }
+        else if (index >= 0 && (size_t)index < fds.size()) {
+          actions.push_back(FdAction(fd, fds[index]));
+        }
+        else {
+          valid = false;
+        }
+      }
+
+      // clone like fork, but the child's parent is the shell
+      int32_t reply[2] = {-1, EINVAL};
+      if (fds.empty()) { /* descriptors were cut off, shell starts it itself */
+        reply[1] = EMSGSIZE;
+      }
+      else if (valid) {
+        reply[0] = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+        reply[1] = errno;
+      }
+      if (reply[0] == 0) { /* code excuted by child */
+        prepareChild(pgid, false);
+        for (int fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++) {
+          dup2(fds[fd], fd);
+        }
+        if (fchdir(fds[SERVER_CWD]) == -1 || !applyFdActions(actions)) {
+          _exit(EXIT_FAILURE);
+        }
+        execve(path, &args[0], &envp[0]);
+
+        // don't expect return unless error
+        _exit(fail_status);
+      }
+      for (size_t i = 0; i < fds.size(); i++) {
+        close(fds[i]);
+      }
+      if (write(sock, reply, sizeof(reply)) != sizeof(reply)) {
+        break;
+      }
+    }
+    _exit(EXIT_SUCCESS);
+  }
+};
+
+// helper used by LAUNCH_SERVER mode, started by the shell when that mode is chosen
+ForkServer fork_server;
+
+/*
+  Start program according to mode.
+*/
+pid_t launchProgram(LaunchSpec & spec, LaunchMode mode) {
+  if (mode == LAUNCH_FORK) {
+    return forkProgram(spec);
+  }
+  if (mode == LAUNCH_SERVER && fork_server.running()) {
+    return fork_server.launch(spec);
+  }
+  return spawnProgram(spec);
+}
+
+/*
+  Decide launch mode from environment variable MYSHELL_LAUNCH, spawn by default.
+*/
+LaunchMode launchModeFromEnv() {
+  const char * mode = getenv("MYSHELL_LAUNCH");
+  if (mode != nullptr && std::strcmp(mode, "fork") == 0) {
+    return LAUNCH_FORK;
+  }
+  if (mode != nullptr && std::strcmp(mode, "server") == 0) {
+    return LAUNCH_SERVER;
+  }
+  return LAUNCH_SPAWN;
+}
+
+#endif
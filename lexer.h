@@ -0,0 +1,602 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "glob.h"
+#include "vartable.h"
+
+/*
+  Function to help determine a character in specific range for $variable
+*/
+bool determineRange(char c) {
+  if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')
+    return true;
+  else
+    return false;
+}
+
+/*
+  Find ')' closing "$(" whose '(' is at open, nested "$(...)" and '\' are skipped.
+  Return its position, or npos if it's not closed.
+*/
+size_t closeSubstitution(const std::string & line, size_t open) {
+  int depth = 0;
+  for (size_t i = open; i < line.size(); i++) {
+    if (line[i] == '\\') {
+      i++;
+    }
+    else if (line[i] == '(') {
+      depth++;
+    }
+    else if (line[i] == ')' && --depth == 0) {
+      return i;
+    }
+  }
+  return std::string::npos;
+}
+
+/* One command of a line after lexing, pointers are valid until the line is lexed again */
+struct LexedCommand {
+  const char * text;  // command with variables replaced and '\' handled, spaces kept
+  char ** args;       // words of command, ends with nullptr
+  size_t count;       // number of words
+  bool blank;         // whether command had nothing but spaces before lexing
+};
+
+#define LEX_HOLE '\x01' /* stands for a variable in a compiled line, never typed */
+
+/*
+  Line lexed once with every variable left as a hole, so a loop body runs again by filling
+  values into its words instead of lexing it again. Made by Lexer::compile().
+*/
+struct LineTemplate {
+  enum HoleKind { VARIABLE, BRACED, COMMAND };
+
+  /* One "$name", "${name}" or "$(command)" in line */
+  struct Hole {
+    HoleKind kind;  // BRACED must match exactly, COMMAND runs again each time
+    size_t dollar;  // offset of '$' in line
+    size_t last;    // offset of last character of it in line
+    size_t name;    // offset of name or command in line
+    size_t length;  // characters of name or command, any longest match may be the variable
+  };
+
+  std::string line;                   // line as typed, lexed again if a value would change words
+  bool usable;                        // false if line has LEX_HOLE itself, then it's always lexed
+  std::vector<Hole> holes;            // variables and commands in order of line
+  std::string text;                   // pruned text with LEX_HOLE for variables
+  std::string words;                  // words with LEX_HOLE for variables
+  std::vector<size_t> word_starts;    // offset of each word in words
+  std::vector<bool> globs;            // whether each word has a pattern character
+  std::vector<size_t> text_starts;    // offset of each command in text
+  std::vector<size_t> first_words;    // index of first word of each command
+  std::vector<bool> blanks;           // whether each command was only spaces
+
+  LineTemplate() :
+      line(),
+      usable(false),
+      holes(),
+      text(),
+      words(),
+      word_starts(),
+      globs(),
+      text_starts(),
+      first_words(),
+      blanks() {}
+};
+
+/*
+  Class to cut a line into commands and words in a single pass.
+  Variables are replaced, '|' splits pipeline stages, and '\' is handled while scanning.
+  All characters go into buffers kept for the next line, so a line allocates nothing
+  once buffers are big enough.
+*/
+class Lexer
+{
+ public:
+  // run command of "$(command)" and give what it printed
+  typedef std::function<void(const std::string &, std::string &)> Capture;
+
+ private:
+  enum State { LEADING, COMMAND, ARGS };
+
+  std::string text;                   // pruned text of every command, separated by '\0'
+  std::string words;                  // every word, separated by '\0'
+  std::vector<size_t> word_starts;    // offset of each word in words
+  std::vector<bool> globs;            // whether each word has '*', '?' or '[' not after '\'
+  std::vector<size_t> text_starts;    // offset of each command in text
+  std::vector<size_t> first_words;    // index of first word of each command
+  std::vector<bool> blanks;           // whether each command was only spaces
+  std::vector<size_t> arg_starts;     // offset in words of every argument after patterns expand
+  std::vector<char *> args;           // words of every command, each list ends with nullptr
+  std::string pattern;                // word being expanded, words grows meanwhile
+  Globber globber;                    // expands patterns, keeps directories read in this line
+  std::vector<LexedCommand> commands;  // result of last line
+  std::vector<std::string> values;    // what each hole of a template is filled with
+  LineTemplate * compiling;           // template variables become holes of, nullptr when lexing
+  const LineTemplate * filling;       // template whose values are fed again, nullptr when lexing
+  size_t next_hole;                   // hole of filling the next '$' may be
+  Capture capture;                    // runs "$(command)", nothing is run if it's empty
+  State state;                        // where we are in current command
+  bool in_word;                       // whether a word is open
+  bool escaped;                       // '\' seen after command, waiting for next character
+
+ public:
+  Lexer() :
+      text(),
+      words(),
+      word_starts(),
+      globs(),
+      text_starts(),
+      first_words(),
+      blanks(),
+      arg_starts(),
+      args(),
+      pattern(),
+      globber(),
+      commands(),
+      values(),
+      compiling(nullptr),
+      filling(nullptr),
+      next_hole(0),
+      capture(),
+      state(LEADING),
+      in_word(false),
+      escaped(false) {}
+
+  /*
+    Set how "$(command)" is run.
+  */
+  void setCapture(const Capture & curt_capture) { capture = curt_capture; }
+  const Capture & getCapture() const { return capture; }
+
+  /*
+    Lex a line typed by user, "cmd1 | cmd2" gives 2 commands.
+    $name is replaced by longest matching variable, or removed with '$' if none matches.
+    ${name} is replaced by variable with exactly that name, or nothing if it's not set.
+    $(command) is replaced by what command prints, newlines at the end removed and others
+    made spaces. Its output is not lexed again, so '|' and '$' in it are plain characters.
+    Before and in the command name every '\' is dropped, after it "\ " is a space inside a word.
+    A word with '*', '?' or "[...]" becomes the names of files it matches, sorted, or stays as it is
+    if none matches. After the command name "\*" is a plain '*'.
+  */
+  std::vector<LexedCommand> & lex(const std::string & line, VarTable & vars) {
+    scan(line, vars);
+    return finish();
+  }
+
+  /*
+    Lex line once for running it many times, every variable becomes a hole in tpl.
+    Words are the same as lex() gives as long as values are not empty and have no ' ' or '\'.
+  */
+  void compile(const std::string & line, VarTable & vars, LineTemplate & tpl) {
+    tpl = LineTemplate();
+    tpl.line = line;
+    if (line.find(LEX_HOLE) != std::string::npos) {
+      return;
+    }
+    compiling = &tpl;
+    scan(line, vars);
+    compiling = nullptr;
+
+    tpl.usable = true;
+    tpl.text = text;
+    tpl.words = words;
+    tpl.word_starts = word_starts;
+    tpl.globs = globs;
+    tpl.text_starts = text_starts;
+    tpl.first_words = first_words;
+    tpl.blanks = blanks;
+  }
+
+  /*
+    Lex a compiled line again with current values of variables and output of commands.
+    Holes are filled into words of template without scanning line, unless a value is empty
+    or has ' ', '\' or a pattern character, which would change words, then line is lexed in full
+    with the same values, so no command runs twice.
+  */
+  std::vector<LexedCommand> & expand(const LineTemplate & tpl, VarTable & vars) {
+    if (!tpl.usable) {
+      return lex(tpl.line, vars);
+    }
+    values.resize(tpl.holes.size());
+    bool fits = true;
+    for (size_t h = 0; h < tpl.holes.size(); h++) {
+      fillHole(tpl, tpl.holes[h], vars, values[h]);
+      fits = fits && !values[h].empty() && values[h].find_first_of(" \\*?[") == std::string::npos;
+    }
+    if (!fits) {
+      filling = &tpl;
+      next_hole = 0;
+      scan(tpl.line, vars);
+      filling = nullptr;
+      return finish();
+    }
+
+    clear();
+    size_t hole = 0;
+    for (size_t n = 0; n < tpl.text_starts.size(); n++) {
+      size_t end = n + 1 < tpl.text_starts.size() ? tpl.text_starts[n + 1] : tpl.text.size();
+      text_starts.push_back(text.size());
+      fill(tpl.text, tpl.text_starts[n], end, text, hole);
+    }
+    hole = 0;
+    for (size_t w = 0; w < tpl.word_starts.size(); w++) {
+      size_t end = w + 1 < tpl.word_starts.size() ? tpl.word_starts[w + 1] : tpl.words.size();
+      word_starts.push_back(words.size());
+      fill(tpl.words, tpl.word_starts[w], end, words, hole);
+    }
+    globs = tpl.globs;
+    first_words = tpl.first_words;
+    blanks = tpl.blanks;
+    return finish();
+  }
+
+  /*
+    Lex one command without variables or pipeline, only "\ " means a space inside a word
+    and other '\' are kept.
+    Used for commands made by the shell itself, like those of "parallel".
+  */
+  LexedCommand & lexWords(const std::string & line) {
+    clear();
+    beginCommand();
+    for (size_t i = 0; i < line.size(); i++) {
+      if (line[i] == '\\' && i + 1 < line.size() && line[i + 1] == ' ') {
+        text += "\\ ";
+        putWordChar(' ');
+        i++;
+      }
+      else if (line[i] == ' ') {
+        text += ' ';
+        endWord();
+      }
+      else {
+        text += line[i];
+        putWordChar(line[i]);
+      }
+    }
+    endCommand(line.find_first_not_of(' ') == std::string::npos);
+
+    return finish()[0];
+  }
+
+ private:
+  /*
+    Cut line into commands and words into buffers, variables are replaced or become holes.
+  */
+  void scan(const std::string & line, VarTable & vars) {
+    clear();
+    beginCommand();
+
+    bool skip_next = false;  // character after '\' never splits pipeline
+    bool blank = true;       // whether current command is only spaces so far
+    for (size_t i = 0; i < line.size(); i++) {
+      char c = line[i];
+      if (skip_next) {
+        skip_next = false;
+      }
+      else if (c == '\\') {
+        skip_next = true;
+      }
+      else if (c == '|') {
+        endCommand(blank);
+        beginCommand();
+        blank = true;
+        continue;
+      }
+
+      if (c != ' ') {
+        blank = false;
+      }
+      if (c == '$') {
+        i = replaceVariable(line, i, vars);
+      }
+      else {
+        feed(c);
+      }
+    }
+    endCommand(blank);
+  }
+
+  /*
+    Forget last line but keep buffers.
+  */
+  void clear() {
+    text.clear();
+    words.clear();
+    word_starts.clear();
+    globs.clear();
+    text_starts.clear();
+    first_words.clear();
+    blanks.clear();
+    arg_starts.clear();
+    args.clear();
+    commands.clear();
+    globber.forget();
+  }
+
+  void beginCommand() {
+    state = LEADING;
+    in_word = false;
+    escaped = false;
+    text_starts.push_back(text.size());
+    first_words.push_back(word_starts.size());
+  }
+
+  void endCommand(bool blank) {
+    endWord();
+    escaped = false;  // '\' at the end is dropped
+    text += '\0';
+    blanks.push_back(blank);
+  }
+
+  /*
+    Find variable after '$' at pos and feed its value.
+    Return position of last character consumed.
+  */
+  size_t replaceVariable(const std::string & line, size_t pos, VarTable & vars) {
+    const char * name = line.c_str() + pos + 1;
+    const std::string * value = nullptr;
+    size_t last = pos;
+
+    if (filling != nullptr && next_hole < filling->holes.size() &&
+        filling->holes[next_hole].dollar == pos) { /* value was got before lexing */
+      feedValue(values[next_hole]);
+      return filling->holes[next_hole++].last;
+    }
+
+    if (name[0] == '(') { /* "$(command)" */
+      size_t close = closeSubstitution(line, pos + 1);
+      if (close == std::string::npos) {
+        return pos;
+      }
+      if (compiling != nullptr) {
+        return makeHole(LineTemplate::COMMAND, pos, close, pos + 2, close - pos - 2);
+      }
+      std::string output;
+      runCapture(line.substr(pos + 2, close - pos - 2), output);
+      feedValue(output);
+      return close;
+    }
+    if (name[0] == '{') { /* "${name}", no guess needed */
+      size_t length = 1;
+      while (determineRange(name[length])) {
+        length++;
+      }
+      if (name[length] == '}') {
+        if (compiling != nullptr) {
+          return makeHole(LineTemplate::BRACED, pos, pos + 1 + length, pos + 2, length - 1);
+        }
+        value = vars.exactMatch(name + 1, length - 1);
+        last = pos + 1 + length;
+      }
+    }
+    else if (compiling != nullptr) { /* variable decided when template is expanded */
+      size_t length = 0;
+      while (determineRange(name[length])) {
+        length++;
+      }
+      if (length > 0) {
+        return makeHole(LineTemplate::VARIABLE, pos, pos + length, pos + 1, length);
+      }
+    }
+    else {
+      size_t length = 0;
+      value = vars.longestMatch(name, length);
+      if (value != nullptr) {
+        last = pos + length;
+      }
+    }
+
+    if (value != nullptr) {
+      feedValue(*value);
+    }
+    return last;
+  }
+
+  void feedValue(const std::string & value) {
+    for (size_t k = 0; k < value.size(); k++) {
+      feed(value[k]);
+    }
+  }
+
+  /*
+    Run command of "$(command)", output is made one line: newlines at the end are removed,
+    others become spaces.
+  */
+  void runCapture(const std::string & command, std::string & output) {
+    output.clear();
+    if (!capture) {
+      return;
+    }
+    capture(command, output);
+    size_t end = output.find_last_not_of('\n');
+    output.erase(end == std::string::npos ? 0 : end + 1);
+    for (size_t k = 0; k < output.size(); k++) {
+      if (output[k] == '\n') {
+        output[k] = ' ';
+      }
+    }
+  }
+
+  /*
+    Keep variable or command from dollar to last of line as a hole of template being compiled,
+    its name or command is length characters at name.
+    Return last.
+  */
+  size_t makeHole(LineTemplate::HoleKind kind, size_t dollar, size_t last, size_t name, size_t length) {
+    LineTemplate::Hole hole;
+    hole.kind = kind;
+    hole.dollar = dollar;
+    hole.last = last;
+    hole.name = name;
+    hole.length = length;
+    compiling->holes.push_back(hole);
+    feed(LEX_HOLE);
+    return last;
+  }
+
+  /*
+    Get what hole stands for now, the same replaceVariable() would feed.
+  */
+  void fillHole(const LineTemplate & tpl,
+                const LineTemplate::Hole & hole,
+                VarTable & vars,
+                std::string & value) {
+    const char * name = tpl.line.c_str() + hole.name;
+    if (hole.kind == LineTemplate::COMMAND) {
+      runCapture(tpl.line.substr(hole.name, hole.length), value);
+    }
+    else if (hole.kind == LineTemplate::BRACED) {
+      const std::string * found = vars.exactMatch(name, hole.length);
+      value.assign(found == nullptr ? "" : *found);
+    }
+    else { /* characters after longest match stay, all of them if none matches */
+      size_t length = 0;
+      const std::string * found = vars.longestMatch(name, length);
+      value.assign(found == nullptr ? "" : *found);
+      value.append(name + length, hole.length - length);
+    }
+  }
+
+  /*
+    Copy part of a template buffer between start and end to out, holes are filled with values
+    from hole on.
+  */
+  void fill(const std::string & from, size_t start, size_t end, std::string & out, size_t & hole) {
+    while (start < end) {
+      const char * found =
+          static_cast<const char *>(std::memchr(from.data() + start, LEX_HOLE, end - start));
+      size_t next = found == nullptr ? end : found - from.data();
+      out.append(from, start, next - start);
+      if (found == nullptr) {
+        return;
+      }
+      out += values[hole++];
+      start = next + 1;
+    }
+  }
+
+  /*
+    Handle one character after variables are replaced.
+  */
+  void feed(char c) {
+    if (state == LEADING) { /* spaces before command are dropped */
+      if (c == ' ')
+        return;
+      state = COMMAND;
+    }
+
+    if (state == COMMAND) {
+      if (c == '\\') /* ignore '\\' in command name */
+        return;
+      text += c;
+      if (c == ' ') { /* first space after command */
+        state = ARGS;
+        endWord();
+      }
+      else {
+        putWordChar(c);
+        markPattern(c);
+      }
+      return;
+    }
+
+    bool quoted = escaped;  // character after '\' is never a pattern
+    if (escaped) {
+      escaped = false;
+      if (c == ' ') { /* "\ " is a space inside word */
+        text += "\\ ";
+        putWordChar(' ');
+        return;
+      }
+    }
+    if (c == '\\') {
+      escaped = true;
+      return;
+    }
+    text += c;
+    if (c == ' ') {
+      endWord();
+    }
+    else {
+      putWordChar(c);
+      if (!quoted) {
+        markPattern(c);
+      }
+    }
+  }
+
+  void putWordChar(char c) {
+    if (!in_word) {
+      in_word = true;
+      word_starts.push_back(words.size());
+      globs.push_back(false);
+    }
+    words += c;
+  }
+
+  void markPattern(char c) {
+    if (isGlobChar(c)) {
+      globs.back() = true;
+    }
+  }
+
+  void endWord() {
+    if (in_word) {
+      in_word = false;
+      words += '\0';
+    }
+  }
+
+  /*
+    Expand patterns, their matches are added to words, then buffers stop growing and
+    offsets turn into pointers.
+  */
+  std::vector<LexedCommand> & finish() {
+    for (size_t n = 0; n < first_words.size(); n++) {
+      size_t last_word = n + 1 < first_words.size() ? first_words[n + 1] : word_starts.size();
+
+      LexedCommand command;
+      command.text = &text[text_starts[n]];
+      command.count = 0;
+      command.blank = blanks[n];
+      command.args = nullptr;
+
+      for (size_t w = first_words[n]; w < last_word; w++) {
+        size_t matched = 0;
+        if (globs[w]) {
+          pattern.assign(&words[word_starts[w]]);
+          if (isPattern(pattern.c_str(), pattern.size())) {
+            matched = globber.expand(pattern, words, arg_starts);
+          }
+        }
+        if (matched == 0) {
+          arg_starts.push_back(word_starts[w]);
+        }
+        command.count += std::max(matched, (size_t)1);
+      }
+      arg_starts.push_back(std::string::npos);
+      commands.push_back(command);
+    }
+
+    for (size_t k = 0; k < arg_starts.size(); k++) {
+      args.push_back(arg_starts[k] == std::string::npos ? nullptr : &words[arg_starts[k]]);
+    }
+
+    // args does not move any more, so each command can point into it
+    size_t next = 0;
+    for (size_t n = 0; n < commands.size(); n++) {
+      commands[n].args = &args[next];
+      next += commands[n].count + 1;
+    }
+    return commands;
+  }
+};
+
+#endif
@@ -1,51 +1,725 @@
+#include <limits.h>
 #include <stdio.h>
 
 #include "xyproject.h"
 
 extern char ** environ;
 
-int main() {
+/*
+  Run commands of a line already lexed, last_status is updated with how it terminated.
+*/
+void runStages(std::vector<LexedCommand> & stages,
+               const std::string & command,
+               bool timed,
+               bool background,
+               EnvStore & env,
+               VarTable & vars,
+               CommandCache & cache,
+               JobTable & jobs,
+               Prompt & prompt,
+               int & last_status) {
+  if (stages.size() == 1 && !background &&
+      isBuiltIn(stages[0].args[0])) { /* for build in instructions like cd */
+    bool utility = isUtility(stages[0].args[0]);
+    UsageLog & log = jobs.usageLog();
+    if (!timed && !log.accountingOn() && !status_stream.on()) {
+      last_status = handleBuiltIn(env, stages[0], vars, cache, jobs, prompt);
+    }
+    else { /* runs inside shell, measure shell itself around it */
+      struct rusage before, after;
+      getrusage(RUSAGE_SELF, &before);
+      double started = monotonicSeconds();
+      last_status = handleBuiltIn(env, stages[0], vars, cache, jobs, prompt);
+      CommandUsage usage(command, monotonicSeconds() - started);
+      getrusage(RUSAGE_SELF, &after);
+      timersub(&after.ru_utime, &before.ru_utime, &after.ru_utime);
+      timersub(&after.ru_stime, &before.ru_stime, &after.ru_stime);
+      after.ru_nvcsw -= before.ru_nvcsw;
+      after.ru_nivcsw -= before.ru_nivcsw;
+      after.ru_maxrss = 0; /* peak of shell's whole life, not of this instruction */
+      usage.add(after);
+      log.record(usage, timed);
+      status_stream.add(0, 0, stages[0].args[0], last_status, started, usage.real, after);
+    }
+
+    // utilities like echo are reported like the programs they replace
+    if (utility) {
+      reportStatus(last_status);
+    }
+  }
+  else { /* for real command or pipeline, create processes */
+    // refresh table in parent, command is resolved before any process is created
+    double refresh_start = tracer.begin();
+    cache.update(env.path());
+    tracer.end("refresh", refresh_start);
+    last_status =
+        handlePipeline(env, stages, vars, cache, jobs, prompt, background, timed, command);
+  }
+}
+
+Flow runNodes(std::vector<ControlNode> & nodes,
+              EnvStore & env,
+              Lexer & lexer,
+              VarTable & vars,
+              CommandCache & cache,
+              JobTable & jobs,
+              Prompt & prompt,
+              ControlFlow & control,
+              int & last_status);
+
+/*
+  Run body of a function or sourced file with args as $1, $2, ..., "return" ends it.
+*/
+Flow runCall(std::vector<ControlNode> & body,
+             const std::vector<std::string> & args,
+             EnvStore & env,
+             Lexer & lexer,
+             VarTable & vars,
+             CommandCache & cache,
+             JobTable & jobs,
+             Prompt & prompt,
+             ControlFlow & control,
+             int & last_status) {
+  CallFrame frame;
+  if (!control.enterCall(vars, args, frame)) {
+    std::cerr << "myShell: maximum function nesting level exceeded (" << CALL_DEPTH << ")\n";
+    last_status = W_EXITCODE(EXIT_FAILURE, 0);
+    return FLOW_NORMAL;
+  }
+  Flow flow = runNodes(body, env, lexer, vars, cache, jobs, prompt, control, last_status);
+  control.leaveCall(vars, frame);
+  return flow == FLOW_RETURN ? FLOW_NORMAL : flow;
+}
+
+/*
+  Run a function or "source file" inside shell. Return false if command is neither, then
+  it's run like any other, otherwise flow tells how it ended.
+  Sourced file is found from current directory, and is parsed again only when it changed.
+*/
+bool runInShell(std::vector<LexedCommand> & stages,
+                bool background,
+                EnvStore & env,
+                Lexer & lexer,
+                VarTable & vars,
+                CommandCache & cache,
+                JobTable & jobs,
+                Prompt & prompt,
+                ControlFlow & control,
+                int & last_status,
+                Flow & flow) {
+  if (stages.size() != 1 || background || stages[0].count == 0) {
+    return false;
+  }
+  std::string name(stages[0].args[0]);
+  bool source = name == "source" || name == ".";
+  std::shared_ptr<std::vector<ControlNode> > body = control.function(name.c_str());
+  if (!source && !body) {
+    return false;
+  }
+
+  // words are copied, lexing the body reuses buffers they are in
+  std::vector<std::string> args(stages[0].args + 1, stages[0].args + stages[0].count);
+  if (source) {
+    if (args.empty()) {
+      std::cerr << name << ": filename argument required\n";
+      last_status = W_EXITCODE(2, 0);
+      flow = FLOW_NORMAL;
+      return true;
+    }
+    std::string path = args[0][0] == '/' ? args[0] : prompt.cwd() + "/" + args[0];
+    body = control.load(path, args[0]);
+    if (!body) {
+      last_status = W_EXITCODE(EXIT_FAILURE, 0);
+      flow = FLOW_NORMAL;
+      return true;
+    }
+    args.erase(args.begin());
+    if (args.empty()) { /* file sees $1, $2, ... of where it's sourced */
+      args = control.arguments();
+    }
+  }
+
+  last_status = EXIT_SUCCESS;
+  flow = runCall(*body, args, env, lexer, vars, cache, jobs, prompt, control, last_status);
+  return true;
+}
+
+/*
+  Run a plain command of a block. It's compiled the first time, later runs only fill in
+  variables, so a loop body is not lexed again.
+*/
+Flow runCommand(ControlNode & node,
+                EnvStore & env,
+                Lexer & lexer,
+                VarTable & vars,
+                CommandCache & cache,
+                JobTable & jobs,
+                Prompt & prompt,
+                ControlFlow & control,
+                int & last_status) {
+  if (!node.prepared) {
+    std::string input(node.text);
+    node.exit = isExit(input);
+    node.timed = takeTime(input);
+    node.background = takeBackground(input);
+    size_t start = input.find_first_not_of(" ");
+    size_t end = input.find_last_not_of(" ");
+    node.command = start == std::string::npos ? "" : input.substr(start, end - start + 1);
+    double lex_start = tracer.begin();
+    lexer.compile(input, vars, node.words);
+    tracer.end("lex", lex_start);
+    node.prepared = true;
+  }
+  if (node.exit) {
+    return FLOW_EXIT;
+  }
+  if (node.command.empty()) {
+    return FLOW_NORMAL;
+  }
+  TraceScope line_scope(tracer, "line", node.command.c_str());
+
+  std::vector<LexedCommand> & stages = lexer.expand(node.words, vars);
+  Flow flow;
+  if (runInShell(stages, node.background, env, lexer, vars, cache, jobs, prompt, control, last_status,
+                 flow)) {
+    return flow;
+  }
+  runStages(stages, node.command, node.timed, node.background, env, vars, cache, jobs, prompt,
+            last_status);
+  return FLOW_NORMAL;
+}
+
+/*
+  Run one loop, while/until runs body as long as condition succeeds/fails, for runs it
+  once for each word after "in". Status is that of last command of body, 0 if it never ran.
+  A program killed by SIGINT stops the loop, like typing Ctrl-C in bash.
+*/
+Flow runLoop(ControlNode & node,
+             EnvStore & env,
+             Lexer & lexer,
+             VarTable & vars,
+             CommandCache & cache,
+             JobTable & jobs,
+             Prompt & prompt,
+             ControlFlow & control,
+             int & last_status) {
+  std::vector<std::string> words;
+  if (node.kind == ControlNode::FOR) { /* words are taken once, body may change variables */
+    std::vector<LexedCommand> & stages = lexer.lex(node.list, vars);
+    for (size_t n = 0; n < stages.size(); n++) {
+      words.insert(words.end(), stages[n].args, stages[n].args + stages[n].count);
+    }
+  }
+
+  control.enterLoop();
+  Flow flow = FLOW_NORMAL;
+  int status = EXIT_SUCCESS;
+  for (size_t i = 0;; i++) {
+    if (node.kind == ControlNode::FOR) {
+      if (i == words.size()) {
+        break;
+      }
+      vars.set(node.text, words[i]);
+    }
+    else {
+      flow = runNodes(node.parts[0], env, lexer, vars, cache, jobs, prompt, control, last_status);
+      if (flow != FLOW_NORMAL) {
+        if (!control.goesOn(flow)) {
+          break;
+        }
+        continue;
+      }
+      if ((last_status == EXIT_SUCCESS) == (node.kind == ControlNode::UNTIL)) {
+        break;
+      }
+    }
+
+    flow = runNodes(node.parts.back(), env, lexer, vars, cache, jobs, prompt, control, last_status);
+    status = last_status;
+    if (!control.goesOn(flow) || (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)) {
+      break;
+    }
+  }
+  control.leaveLoop();
+  last_status = status;
+  return flow;
+}
+
+/*
+  Run one command of a block.
+*/
+Flow runNode(ControlNode & node,
+             EnvStore & env,
+             Lexer & lexer,
+             VarTable & vars,
+             CommandCache & cache,
+             JobTable & jobs,
+             Prompt & prompt,
+             ControlFlow & control,
+             int & last_status) {
+  switch (node.kind) {
+    case ControlNode::COMMAND:
+      return runCommand(node, env, lexer, vars, cache, jobs, prompt, control, last_status);
+    case ControlNode::IF:
+      for (size_t k = 0; k + 1 < node.parts.size(); k += 2) { /* condition, then its body */
+        Flow flow =
+            runNodes(node.parts[k], env, lexer, vars, cache, jobs, prompt, control, last_status);
+        if (flow != FLOW_NORMAL) {
+          return flow;
+        }
+        if (last_status == EXIT_SUCCESS) {
+          return runNodes(node.parts[k + 1], env, lexer, vars, cache, jobs, prompt, control, last_status);
+        }
+      }
+      if (node.parts.size() % 2 == 1) { /* else */
+        return runNodes(node.parts.back(), env, lexer, vars, cache, jobs, prompt, control, last_status);
+      }
+      last_status = EXIT_SUCCESS;
+      return FLOW_NORMAL;
+    case ControlNode::WHILE:
+    case ControlNode::UNTIL:
+    case ControlNode::FOR:
+      return runLoop(node, env, lexer, vars, cache, jobs, prompt, control, last_status);
+    case ControlNode::BREAK:
+    case ControlNode::CONTINUE:
+      last_status = EXIT_SUCCESS;
+      if (!control.inLoop()) {
+        std::cerr << (node.kind == ControlNode::BREAK ? "break" : "continue")
+                  << ": only meaningful in a loop\n";
+        return FLOW_NORMAL;
+      }
+      control.leave(node.levels);
+      return node.kind == ControlNode::BREAK ? FLOW_BREAK : FLOW_CONTINUE;
+    case ControlNode::FUNCTION:
+      control.define(node.text, node.body);
+      last_status = EXIT_SUCCESS;
+      return FLOW_NORMAL;
+    case ControlNode::RETURN:
+      if (!control.inCall()) {
+        std::cerr << "return: can only `return' from a function or sourced script\n";
+        last_status = W_EXITCODE(EXIT_FAILURE, 0);
+        return FLOW_NORMAL;
+      }
+      if (node.levels >= 0) {
+        last_status = W_EXITCODE(node.levels, 0);
+      }
+      return FLOW_RETURN;
+  }
+  return FLOW_NORMAL;
+}
+
+/*
+  Run commands of a block in order, until one breaks out of a loop or exits.
+*/
+Flow runNodes(std::vector<ControlNode> & nodes,
+              EnvStore & env,
+              Lexer & lexer,
+              VarTable & vars,
+              CommandCache & cache,
+              JobTable & jobs,
+              Prompt & prompt,
+              ControlFlow & control,
+              int & last_status) {
+  for (size_t i = 0; i < nodes.size(); i++) {
+    Flow flow = runNode(nodes[i], env, lexer, vars, cache, jobs, prompt, control, last_status);
+    if (flow != FLOW_NORMAL) {
+      return flow;
+    }
+  }
+  return FLOW_NORMAL;
+}
+
+/*
+  Handle one line of input, return false if it is exit.
+  Lines of an if/while/until/for block or a function are collected, the block runs when its
+  last line comes.
+  last_status is updated with how the line terminated.
+*/
+bool handleLine(std::string & input,
+                EnvStore & env,
+                Lexer & lexer,
+                VarTable & vars,
+                CommandCache & cache,
+                JobTable & jobs,
+                Prompt & prompt,
+                ControlFlow & control,
+                int & last_status) {
+  if (control.collecting() || ControlFlow::startsBlock(input)) {
+    ControlFlow::Result result = control.add(input);
+    if (result == ControlFlow::PARSE_ERROR) {
+      last_status = W_EXITCODE(2, 0);
+    }
+    if (result != ControlFlow::PARSE_DONE) {
+      return true;
+    }
+    std::vector<ControlNode> block;
+    control.take(block);
+    return runNodes(block, env, lexer, vars, cache, jobs, prompt, control, last_status) != FLOW_EXIT;
+  }
+
+  // if input is only white space, then continue without and fork()
+  if (isSpace(input)) {
+    return true;
+  }
+
+  // if input is exit, then exit
+  if (isExit(input))
+    return false;
+
+  // "time" at the start prints resources used by the line, '&' at the end runs it in background
+  bool timed = takeTime(input);
+  bool background = takeBackground(input);
+  if (timed && isSpace(input)) { /* nothing to measure */
+    return true;
+  }
+  size_t start = input.find_first_not_of(" ");
+  size_t end = input.find_last_not_of(" ");
+  std::string command = start == std::string::npos ? "" : input.substr(start, end - start + 1);
+  TraceScope line_scope(tracer, "line", command.c_str());
+
+  // pipeline has several commands, line is cut into commands and words in one pass
+  double lex_start = tracer.begin();
+  std::vector<LexedCommand> & stages = lexer.lex(input, vars);
+  tracer.end("lex", lex_start);
+
+  Flow flow;
+  if (runInShell(stages, background, env, lexer, vars, cache, jobs, prompt, control, last_status,
+                 flow)) {
+    return flow != FLOW_EXIT;
+  }
+  runStages(stages, command, timed, background, env, vars, cache, jobs, prompt, last_status);
+  return true;
+}
+
+/*
+  Run command of "$(command)" and put what it prints in output.
+  A built-in instruction alone runs in shell itself with std::cout going to a buffer, so it
+  needs no fork and what it changes, like variables, stays. Anything else runs in a forked copy
+  of shell whose stdout is a pipe, read into a buffer that doubles when it's full.
+*/
+void captureCommand(const std::string & command,
+                    std::string & output,
+                    const Lexer::Capture & capture,
+                    EnvStore & env,
+                    VarTable & vars,
+                    CommandCache & cache,
+                    JobTable & jobs,
+                    Prompt & prompt,
+                    ControlFlow & control,
+                    int & last_status) {
+  TraceScope scope(tracer, "capture", command.c_str());
+  Lexer lexer;
+  lexer.setCapture(capture);
+
+  // first word is looked at before lexing, so nothing inside runs twice
+  size_t start = command.find_first_not_of(' ');
+  std::string first =
+      start == std::string::npos ? "" : command.substr(start, command.find(' ', start) - start);
+  if (printsOnly(first.c_str()) && !control.function(first.c_str()) &&
+      command.find_first_of("|<>&") == std::string::npos) {
+    std::vector<LexedCommand> & stages = lexer.lex(command, vars);
+    std::ostringstream captured;
+    std::cout.flush();
+    std::streambuf * saved = std::cout.rdbuf(captured.rdbuf());
+    last_status = handleBuiltIn(env, stages[0], vars, cache, jobs, prompt);
+    std::cout.rdbuf(saved);
+    output = captured.str();
+    return;
+  }
+
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    std::cerr << "pipe: " << std::strerror(errno) << std::endl;
+    last_status = W_EXITCODE(EXIT_FAILURE, 0);
+    return;
+  }
+  std::cout.flush();
+  pid_t pid = fork();
+  if (pid == 0) { /* copy of shell runs line like it was typed, without reporting */
+    dup2(fds[1], STDOUT_FILENO);
+    shell_options.report_status = false;
+    jobs.leaveJobControl();
+    std::string input(command);
+    handleLine(input, env, lexer, vars, cache, jobs, prompt, control, last_status);
+    control.endOfInput();
+    std::cout.flush();
+    _exit(WIFSIGNALED(last_status) ? 128 + WTERMSIG(last_status) : WEXITSTATUS(last_status));
+  }
+  close(fds[1]);
+  if (pid == -1) {
+    std::cerr << "fork: " << std::strerror(errno) << std::endl;
+    close(fds[0]);
+    last_status = W_EXITCODE(EXIT_FAILURE, 0);
+    return;
+  }
+
+  // read straight into free space of output, which doubles when full
+  size_t used = 0;
+  output.resize(4096);
+  while (true) {
+    if (used == output.size()) {
+      output.resize(output.size() * 2);
+    }
+    ssize_t len = read(fds[0], &output[used], output.size() - used);
+    if (len == -1 && errno == EINTR) {
+      continue;
+    }
+    if (len <= 0) {
+      break;
+    }
+    used += len;
+  }
+  output.resize(used);
+  close(fds[0]);
+
+  int wstatus;
+  while (waitpid(pid, &wstatus, 0) == -1 && errno == EINTR) {
+  }
+  last_status = wstatus;
+}
+
+/*
+  Find what a word typed in the line editor may become: names of commands in PATH, built-in
+  instructions and functions in place of a command name, otherwise names of files.
+*/
+void completeWord(const std::string & word,
+                  bool command,
+                  std::vector<std::string> & found,
+                  EnvStore & env,
+                  CommandCache & cache,
+                  Prompt & prompt,
+                  ControlFlow & control,
+                  FileCompleter & files) {
+  if (!command || word.find('/') != std::string::npos) {
+    files.complete(word, prompt.cwd(), found);
+    return;
+  }
+  cache.update(env.path());
+  cache.complete(word, found);
+  for (std::unordered_map<std::string, BuiltinKind>::const_iterator it = BUILTIN.begin();
+       it != BUILTIN.end();
+       ++it) {
+    if (it->first.compare(0, word.size(), word) == 0) {
+      found.push_back(it->first);
+    }
+  }
+  control.functionNames(word, found);
+  std::sort(found.begin(), found.end());
+  found.erase(std::unique(found.begin(), found.end()), found.end());
+}
+
+/*
+  Print summary of measured commands to stderr when accounting mode is on.
+*/
+void printAccounting(JobTable & jobs) {
+  if (jobs.usageLog().accountingOn()) {
+    jobs.usageLog().summary(std::cerr);
+  }
+}
+
+/*
+  Write timeline of traced phases if tracing is on.
+*/
+void flushTrace() {
+  if (!tracer.flush()) {
+    std::cerr << "myShell: cannot write trace: " << std::strerror(errno) << std::endl;
+  }
+}
+
+/*
+  Start status stream on descriptor given as text, print error if it's not an open descriptor.
+*/
+bool openStatusStream(const char * text) {
+  char * end;
+  long fd = strtol(text, &end, 10);
+  if (end == text || *end != 0 || fd < 0 || fd > INT_MAX || !status_stream.open(fd)) {
+    std::cerr << "myShell: " << text << ": not an open file descriptor\n";
+    return false;
+  }
+  return true;
+}
+
+/*
+  Usage:
+  myShell                  read commands from stdin with prompt
+  myShell [-v] script      run commands in script file
+  myShell [-v] -c string   run commands in string
+  -v prints exit status of every program when running script or string.
+  -t file (or MYSHELL_TRACE=file) writes a timeline of phases of shell to file when it exits.
+  -s fd (or MYSHELL_STATUS_FD=fd) writes a JSON line for every finished command to descriptor fd,
+  and "Program exited with status" goes to stderr.
+*/
+int main(int argc, char ** argv) {
   // input - stores input command every time user types
+  // env - stores environment variables given to programs, rebuilt only when changed
+  // lexer - cuts every line into commands and words, keeps its buffers for next line
   // vars - stores all set variables
+  // cache - stores command name -> path table, built once and shared by all commands
+  // jobs - stores background and stopped jobs
+  // prompt - stores current directory and prompt showing it
+  // control - collects lines of if/while/for blocks, and runs them
+  // editor - reads lines typed on a terminal, with Tab completion
+  // files - keeps directory listings file names are completed from
+  // last_status - stores how the last command terminated
   std::string input;
-  std::unordered_map<std::string, std::string> vars;
+  EnvStore env;
+  Lexer lexer;
+  VarTable vars;
+  CommandCache cache;
+  JobTable jobs;
+  Prompt prompt;
+  ControlFlow control;
+  LineEditor editor;
+  FileCompleter files;
+  int last_status = EXIT_SUCCESS;
 
-  // print shell information with current directory
-  printShell();
+  // decide how to start real commands, a fork server starts now while the shell is small
+  shell_options.launch_mode = launchModeFromEnv();
+  if (shell_options.launch_mode == LAUNCH_SERVER && !fork_server.start()) {
+    std::cerr << "myShell: fork server: " << std::strerror(errno) << std::endl;
+    shell_options.launch_mode = LAUNCH_SPAWN;
+  }
 
-  // define two variables to store environment variables
-  std::vector<char *> envs;
-  char * env_path = nullptr;
+  // "$(command)" runs with the same state as lines typed
+  Lexer::Capture capture;
+  capture = [&](const std::string & command, std::string & output) {
+    captureCommand(command, output, capture, env, vars, cache, jobs, prompt, control, last_status);
+  };
+  lexer.setCapture(capture);
 
-  // read from stdin
-  while (std::getline(std::cin, input)) {
-    // preset environ vars
-    envs = setEnv(environ);
-    env_path = getenv("PATH");
+  // Tab completes words of lines typed on a terminal
+  editor.setCompleter([&](const std::string & word, bool command, std::vector<std::string> & found) {
+    completeWord(word, command, found, env, cache, prompt, control, files);
+  });
 
-    // if input is only white space, then continue without and fork()
-    if (isSpace(input)) {
-      printShell();
-      continue;
-    }
+  // measure every command if asked, summary is printed at exit
+  jobs.usageLog().setAccounting(getenv("MYSHELL_ACCOUNT") != nullptr);
+
+  // trace phases of shell if asked, option given below wins
+  const char * trace_path = getenv("MYSHELL_TRACE");
+  if (trace_path != nullptr && trace_path[0] != 0) {
+    tracer.start(trace_path);
+  }
 
-    // if input is exit, then exit
-    if (isExit(input))
+  // send status records to a descriptor if asked, option given below wins
+  const char * status_fd = getenv("MYSHELL_STATUS_FD");
+  if (status_fd != nullptr && status_fd[0] != 0 && !openStatusStream(status_fd)) {
+    return 2;
+  }
+
+  // check arguments to decide where commands come from
+  bool verbose = false;
+  const char * command_string = nullptr;
+  const char * script_path = nullptr;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; i++) {
+    std::string option(argv[i]);
+    if (option == "-v") {
+      verbose = true;
+    }
+    else if (option == "-t" && i + 1 < argc) {
+      tracer.start(argv[++i]);
+    }
+    else if (option == "-s" && i + 1 < argc) {
+      if (!openStatusStream(argv[++i])) {
+        return 2;
+      }
+    }
+    else if (option == "-c" && i + 1 < argc) {
+      command_string = argv[++i];
       break;
+    }
+    else {
+      std::cerr << "myShell: " << option << ": invalid option\n";
+      std::cerr << "usage: myShell [-v] [-t file] [-s fd] [script | -c string]\n";
+      return 2;
+    }
+  }
+  if (command_string == nullptr && i < argc) {
+    script_path = argv[i];
+  }
+
+  if (command_string != nullptr || script_path != nullptr) { /* run script without prompt */
+    ScriptInput script;
+    if (command_string != nullptr) {
+      script.openString(command_string);
+    }
+    else if (!script.openFile(script_path)) {
+      std::cerr << "myShell: " << script_path << ": " << std::strerror(errno) << std::endl;
+      return 127;
+    }
 
-    // prune input for potential variable and '\'
-    input = pruneInput(input, vars);
+    shell_options.show_prompt = false;
+    shell_options.report_status = verbose;
+    jobs.init(false);
 
-    if (isBuiltIn(input)) { /* for build in instructions like cd */
-      handleBuiltIn(envs, env_path, input, vars);
+    double read_start = tracer.begin();
+    while (script.next(input)) {
+      tracer.end("read", read_start);
+      if (!handleLine(input, env, lexer, vars, cache, jobs, prompt, control, last_status)) {
+        last_status = EXIT_SUCCESS;
+        break;
+      }
+      jobs.notify(shell_options.report_status);
+      read_start = tracer.begin();
     }
-    else { /* for real command, create process */
-      handleProcess(fork(), envs, env_path, input);
+    if (control.endOfInput()) {
+      last_status = W_EXITCODE(2, 0);
     }
+
+    // print program information before exit
+    reportStatus(W_EXITCODE(WEXITSTATUS(last_status), 0));
+    std::cout.flush();
+    printAccounting(jobs);
+    flushTrace();
+    status_stream.flush();
+
+    return WIFSIGNALED(last_status) ? 128 + WTERMSIG(last_status) : WEXITSTATUS(last_status);
   }
 
+  // take terminal for job control if there's one
+  jobs.init(true);
+
+  // lines typed on a terminal go to history file, Up and Ctrl-R look back through it
+  shell_history.setFile();
+  editor.setHistory(&shell_history);
+
+  // print shell information with current directory
+  printShell(prompt, env);
+
+  // read from stdin, time of waiting for user is traced too
+  double read_start = tracer.begin();
+  while (editor.readLine(input, prompt.lastShown())) {
+    tracer.end("read", read_start);
+    if (editor.onTerminal()) { /* piped input is not typed by user */
+      shell_history.add(input);
+    }
+    if (!handleLine(input, env, lexer, vars, cache, jobs, prompt, control, last_status))
+      break;
+
+    // tell which background jobs finished, then print shell information for next input
+    jobs.notify(shell_options.report_status);
+    double prompt_start = tracer.begin();
+    if (control.collecting()) { /* block goes on, ask for its next line */
+      printContinuation(prompt);
+    }
+    else {
+      printShell(prompt, env);
+    }
+    tracer.end("prompt", prompt_start);
+    status_stream.flush();  // user may take long to type
+    read_start = tracer.begin();
+  }
+  control.endOfInput();
+
+  // stopped jobs cannot go on without shell
+  jobs.hangUpStopped();
+
   // print program information before exit
-  std::cout << "Program exited with status " << EXIT_SUCCESS << std::endl;
+  reportOutput() << "Program exited with status " << EXIT_SUCCESS << std::endl;
+  printAccounting(jobs);
+  flushTrace();
+  status_stream.flush();
 
   return EXIT_SUCCESS;
 }
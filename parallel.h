@@ -0,0 +1,242 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "jobs.h"
+#include "launch.h"
+
+/* Class for running many commands at the same time, output of each one kept in its own buffer */
+class ParallelRunner
+{
+ public:
+  // start item with descriptor changes in spec and set argv[0] of it, return pid or -1 with
+  // status to report
+  typedef std::function<pid_t(size_t, LaunchSpec &, int &, std::string &)> Launcher;
+
+ private:
+  /* One running command */
+  struct Slot {
+    size_t item;       // which item it runs
+    pid_t pid;         // pid of child
+    std::string name;  // argv[0] of child, for status records
+    double started;    // monotonic time child started, in seconds
+    int out_fd;        // read end of child's stdout, -1 after end of file
+    int err_fd;        // read end of child's stderr, -1 after end of file
+    std::string out;   // everything child printed to stdout
+    std::string err;   // everything child printed to stderr
+    bool exited;       // whether child terminated
+    int status;        // how child terminated
+  };
+
+  JobTable & jobs;          // reaps children, tells when they terminate and records them
+  size_t max_slots;         // how many children may run at once
+  std::vector<Slot> slots;  // running children
+  size_t failed;            // how many commands failed
+
+ public:
+  ParallelRunner(JobTable & curt_jobs, size_t curt_max) :
+      jobs(curt_jobs),
+      max_slots(curt_max == 0 ? 1 : curt_max),
+      slots(),
+      failed(0) {}
+
+  /*
+    Run every command of commands, new one starts as soon as a slot is free.
+    Output of every command is printed at once when it finishes, so lines never interleave.
+    Return number of commands that failed.
+  */
+  size_t run(const std::vector<std::string> & commands, Launcher launch) {
+    size_t next = 0;
+    while (next < commands.size() || !slots.empty()) {
+      // fill free slots with new work
+      while (slots.size() < max_slots && next < commands.size()) {
+        start(next++, launch);
+      }
+      if (slots.empty()) {
+        continue;
+      }
+
+      waitSlots(commands);
+      finishSlots();
+    }
+    return failed;
+  }
+
+ private:
+  /*
+    Start one item with stdout and stderr going into pipes.
+  */
+  void start(size_t item, Launcher & launch) {
+    int out[2];
+    int err[2];
+    if (pipe2(out, O_CLOEXEC) == -1) {
+      std::cerr << "pipe: " << std::strerror(errno) << std::endl;
+      failed++;
+      return;
+    }
+    if (pipe2(err, O_CLOEXEC) == -1) {
+      std::cerr << "pipe: " << std::strerror(errno) << std::endl;
+      close(out[0]);
+      close(out[1]);
+      failed++;
+      return;
+    }
+
+    // children never read terminal or input of shell
+    LaunchSpec spec;
+    spec.actions.push_back(FdAction(STDIN_FILENO, "/dev/null", O_RDONLY));
+    spec.actions.push_back(FdAction(STDOUT_FILENO, out[1]));
+    spec.actions.push_back(FdAction(STDERR_FILENO, err[1]));
+
+    int status = 0;
+    std::string name;
+    double started = monotonicSeconds();
+    pid_t pid = launch(item, spec, status, name);
+    close(out[1]);
+    close(err[1]);
+    if (pid == -1) { /* nothing started, that's a failure whatever status says */
+      close(out[0]);
+      close(err[0]);
+      failed++;
+      if (status_stream.on()) {
+        struct rusage none;
+        std::memset(&none, 0, sizeof(none));
+        status_stream.add(0, -1, name, status, started, 0, none);
+      }
+      return;
+    }
+
+    Slot slot;
+    slot.item = item;
+    slot.pid = pid;
+    slot.name = name;
+    slot.started = started;
+    slot.out_fd = out[0];
+    slot.err_fd = err[0];
+    slot.exited = false;
+    slot.status = 0;
+    slots.push_back(slot);
+  }
+
+  /*
+    Block until some child prints something or terminates, then collect it.
+    A terminated child is recorded like any finished command.
+  */
+  void waitSlots(const std::vector<std::string> & commands) {
+    std::vector<struct pollfd> pfds;
+    std::vector<int *> owners;  // which slot descriptor each pollfd belongs to
+
+    struct pollfd sig;
+    sig.fd = jobs.signalFd();
+    sig.events = POLLIN;
+    pfds.push_back(sig);
+    owners.push_back(nullptr);
+
+    for (size_t i = 0; i < slots.size(); i++) {
+      int * fds[2] = {&slots[i].out_fd, &slots[i].err_fd};
+      for (size_t k = 0; k < 2; k++) {
+        if (*fds[k] == -1)
+          continue;
+        struct pollfd pfd;
+        pfd.fd = *fds[k];
+        pfd.events = POLLIN;
+        pfds.push_back(pfd);
+        owners.push_back(fds[k]);
+      }
+    }
+
+    if (poll(&pfds[0], pfds.size(), -1) == -1) {
+      return;
+    }
+
+    // read what is ready, buffers grow by whole chunks
+    char buffer[65536];
+    for (size_t i = 1; i < pfds.size(); i++) {
+      if (pfds[i].revents == 0)
+        continue;
+      ssize_t len = read(pfds[i].fd, buffer, sizeof(buffer));
+      if (len > 0) {
+        Slot & slot = ownerSlot(owners[i]);
+        std::string & target = owners[i] == &slot.out_fd ? slot.out : slot.err;
+        target.append(buffer, len);
+      }
+      else if (len == 0 || errno != EINTR) {
+        close(*owners[i]);
+        *owners[i] = -1;
+      }
+    }
+
+    // children that terminated
+    jobs.reap();
+    for (size_t i = 0; i < slots.size(); i++) {
+      JobProcess proc(slots[i].pid);
+      if (!slots[i].exited && jobs.claim(slots[i].pid, proc)) {
+        slots[i].exited = true;
+        slots[i].status = proc.status;
+        proc.name = slots[i].name;
+        jobs.recordProcess(commands[slots[i].item], proc, slots[i].started);
+      }
+    }
+  }
+
+  /*
+    Print output of children that terminated and closed their output, and free their slots.
+  */
+  void finishSlots() {
+    size_t i = 0;
+    while (i < slots.size()) {
+      Slot & slot = slots[i];
+      if (!slot.exited || slot.out_fd != -1 || slot.err_fd != -1) {
+        i++;
+        continue;
+      }
+
+      std::cout.flush();
+      writeAll(STDOUT_FILENO, slot.out);
+      writeAll(STDERR_FILENO, slot.err);
+      if (!WIFEXITED(slot.status) || WEXITSTATUS(slot.status) != 0) {
+        failed++;
+      }
+      slots.erase(slots.begin() + i);
+    }
+  }
+
+  /*
+    Find slot owning a descriptor field.
+  */
+  Slot & ownerSlot(int * fd) {
+    for (size_t i = 0; i < slots.size(); i++) {
+      if (fd == &slots[i].out_fd || fd == &slots[i].err_fd)
+        return slots[i];
+    }
+    return slots[0];
+  }
+
+  /*
+    Write whole buffer to descriptor.
+  */
+  static void writeAll(int fd, const std::string & data) {
+    size_t done = 0;
+    while (done < data.size()) {
+      ssize_t len = write(fd, data.data() + done, data.size() - done);
+      if (len == -1) {
+        if (errno == EINTR)
+          continue;
+        return;
+      }
+      done += len;
+    }
+  }
+};
+
+#endif
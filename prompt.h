@@ -0,0 +1,191 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#include <errno.h>
+#include <limits.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "envstore.h"
+
+#define DEFAULT_PS1 "myShell$:\\w $ " /* prompt used when PS1 is not set */
+#define DEFAULT_PS2 "> "              /* prompt for next line of a block when PS2 is not set */
+
+/*
+  Class for current directory of shell and the prompt showing it.
+  Directory is found again only after "cd", or when it was renamed or removed underneath
+  the shell. Prompt is made from PS1 only when directory or PS1 changed.
+*/
+class Prompt
+{
+ private:
+  std::string directory;      // current directory of shell
+  dev_t dir_dev;              // device of directory, to find it was replaced
+  ino_t dir_ino;              // inode of directory, to find it was replaced
+  std::string format;         // PS1 last taken from environment
+  bool has_format;            // whether format was taken at all
+  unsigned long env_version;  // version of environment format was taken from
+  std::string rendered;       // prompt made from format
+  std::string shown;          // prompt printed last, PS1 or PS2
+  bool dirty;                 // whether rendered must be made again
+
+ public:
+  Prompt() :
+      directory(),
+      dir_dev(0),
+      dir_ino(0),
+      format(),
+      has_format(false),
+      env_version(0),
+      rendered(),
+      shown(),
+      dirty(true) {}
+
+  /*
+    Find current directory again, called after "cd" changed it.
+    Return false if it cannot be found, then last one is kept.
+  */
+  bool update() {
+    char * cwd = getcwd(nullptr, 0);  // buffer as long as needed
+    if (cwd == nullptr) {
+      return false;
+    }
+    directory = cwd;
+    free(cwd);
+
+    struct stat info;
+    if (stat(directory.c_str(), &info) == 0) {
+      dir_dev = info.st_dev;
+      dir_ino = info.st_ino;
+    }
+    dirty = true;
+    return true;
+  }
+
+  /*
+    Get current directory. One stat() checks it's still the same directory under the same path,
+    otherwise something outside the shell moved it and it's found again.
+  */
+  const std::string & cwd() {
+    struct stat info;
+    if (directory.empty() || stat(directory.c_str(), &info) != 0 || info.st_dev != dir_dev ||
+        info.st_ino != dir_ino) {
+      update();
+    }
+    return directory;
+  }
+
+  /*
+    Print prompt with a single write().
+    PS1 may use \w (current directory), \W (its last part), \u (user), \h (host),
+    \$ ('#' for root, '$' otherwise), \n, \e, \\ and "\ ".
+  */
+  void print(EnvStore & env) {
+    cwd();
+    if (!has_format || env.getVersion() != env_version) { /* environment changed, check PS1 */
+      const char * ps1 = getenv("PS1");
+      std::string curt_format(ps1 == nullptr ? DEFAULT_PS1 : ps1);
+      if (!has_format || curt_format != format) {
+        format = curt_format;
+        dirty = true;
+      }
+      has_format = true;
+      env_version = env.getVersion();
+    }
+    if (dirty) {
+      render();
+    }
+
+    writePrompt(rendered);
+  }
+
+  /*
+    Print prompt for next line of an unfinished block, PS2 as it is.
+  */
+  void printContinuation() {
+    const char * ps2 = getenv("PS2");
+    writePrompt(ps2 == nullptr ? DEFAULT_PS2 : ps2);
+  }
+
+  /*
+    Get prompt printed last, for the line editor to print again.
+  */
+  const std::string & lastShown() const { return shown; }
+
+ private:
+  /*
+    Write prompt with a single write(), anything printed before must come first.
+  */
+  void writePrompt(const std::string & text) {
+    shown = text;
+    std::cout.flush();
+    size_t done = 0;
+    while (done < text.size()) {
+      ssize_t len = write(STDOUT_FILENO, text.data() + done, text.size() - done);
+      if (len == -1 && errno == EINTR) {
+        continue;
+      }
+      if (len <= 0) {
+        break;
+      }
+      done += len;
+    }
+  }
+
+  /*
+    Make prompt from format.
+  */
+  void render() {
+    rendered.clear();
+    for (size_t i = 0; i < format.size(); i++) {
+      if (format[i] != '\\' || i + 1 == format.size()) {
+        rendered += format[i];
+        continue;
+      }
+
+      char c = format[++i];
+      if (c == 'w') {
+        rendered += directory;
+      }
+      else if (c == 'W') {
+        size_t slash = directory.find_last_of('/');
+        rendered += slash == std::string::npos || directory.size() == 1 ? directory
+                                                                        : directory.substr(slash + 1);
+      }
+      else if (c == 'u') {
+        struct passwd * pw = getpwuid(geteuid());
+        rendered += pw == nullptr ? "" : pw->pw_name;
+      }
+      else if (c == 'h') {
+        char host[HOST_NAME_MAX + 1] = {0};
+        gethostname(host, HOST_NAME_MAX);
+        std::string name(host);
+        rendered += name.substr(0, name.find('.'));
+      }
+      else if (c == '$') {
+        rendered += geteuid() == 0 ? '#' : '$';
+      }
+      else if (c == 'n') {
+        rendered += '\n';
+      }
+      else if (c == 'e') {
+        rendered += '\033';
+      }
+      else if (c == '\\' || c == ' ') { /* "\ " is how "set" keeps a space at the end */
+        rendered += c;
+      }
+      else { /* not special, keep as it is */
+        rendered += '\\';
+        rendered += c;
+      }
+    }
+    dirty = false;
+  }
+};
+
+#endif
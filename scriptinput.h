@@ -0,0 +1,110 @@
+#ifndef SCRIPTINPUT_H
+#define SCRIPTINPUT_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+  Class for commands read from a script file or "-c" string, split into lines before running.
+  Command lines are copied out when split, so a script that rewrites or truncates its own file
+  while running changes nothing, where reading a mapping past its new end would raise SIGBUS.
+*/
+class ScriptInput
+{
+ private:
+  std::string text;                               // every command line, one after another
+  std::vector<std::pair<size_t, size_t> > lines;  // start and length in text of every line
+  size_t curt;                                    // next line to return
+
+ public:
+  ScriptInput() : text(), lines(), curt(0) {}
+
+  /*
+    Map script file into memory and split it, return false with errno set if it cannot be read.
+  */
+  bool openFile(const char * path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+      close(fd);
+      return false;
+    }
+
+    if (st.st_size > 0) { /* empty file cannot be mapped, and has no lines anyway */
+      void * addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        close(fd);
+        return false;
+      }
+      madvise(addr, st.st_size, MADV_SEQUENTIAL);
+      splitLines(static_cast<const char *>(addr), st.st_size);
+      munmap(addr, st.st_size);
+    }
+    close(fd);
+    return true;
+  }
+
+  /*
+    Use string given by "-c" as script.
+  */
+  void openString(const char * str) {
+    splitLines(str, std::strlen(str));
+  }
+
+  /*
+    Get next command line, return false when script ends.
+  */
+  bool next(std::string & input) {
+    if (curt == lines.size()) {
+      return false;
+    }
+    input.assign(text.data() + lines[curt].first, lines[curt].second);
+    curt++;
+    return true;
+  }
+
+ private:
+  /*
+    Find every line of data in one pass and copy it to text, blank lines and comments starting
+    with '#' are dropped here so they never reach the shell.
+  */
+  void splitLines(const char * data, size_t size) {
+    text.reserve(size);
+    size_t start = 0;
+    while (start < size) {
+      const char * found = static_cast<const char *>(std::memchr(data + start, '\n', size - start));
+      size_t end = found == nullptr ? size : found - data;
+
+      // '\r' of files written on windows is not part of command
+      size_t len = end - start;
+      if (len > 0 && data[start + len - 1] == '\r') {
+        len--;
+      }
+
+      // skip leading spaces to find out what kind of line it is
+      size_t first = start;
+      while (first < start + len && data[first] == ' ') {
+        first++;
+      }
+      if (first < start + len && data[first] != '#') {
+        lines.push_back(std::make_pair(text.size(), len));
+        text.append(data + start, len);
+      }
+
+      start = end + 1;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef STATUSSTREAM_H
+#define STATUSSTREAM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include "accounting.h"
+#include "json.h"
+
+#define STATUS_BATCH_BYTES 4096 /* records kept before they are written together */
+#define STATUS_BATCH_MS 10      /* longest time a record waits while shell waits for a child */
+
+/*
+  Class for writing one JSON line per finished command to a descriptor given by the user, for
+  programs driving the shell. A record is like
+  {"job":1,"pid":4242,"argv0":"ls","status":0,"signal":0,"start":1760000000.000123,
+   "real":0.001234,"user":0.000500,"sys":0.000700,"maxrss":3120}
+  on one line. "pid" and "maxrss" are 0 for a built-in instruction run in shell itself, "pid" is
+  -1 for a command that could not start, "status" is the exit status or 128 plus signal, "start"
+  is seconds since 1970. Records are kept in a buffer and written together: when it's full, when
+  shell waits for input, when shell waits for a child over STATUS_BATCH_MS, and when it exits.
+*/
+class StatusStream
+{
+ private:
+  int fd;               // descriptor records are written to, -1 when off
+  std::string pending;  // records not written yet
+  double oldest;        // monotonic time first pending record was made, 0 when none is
+  double epoch;         // real time minus monotonic time, turns monotonic start into real
+  pid_t owner;          // process that writes, a forked copy of shell never does
+
+ public:
+  StatusStream() : fd(-1), pending(), oldest(0), epoch(0), owner(0) {}
+
+  ~StatusStream() { flush(); }
+
+  bool on() const { return fd != -1; }
+
+  /*
+    Start writing records to descriptor curt_fd, which commands don't inherit.
+    Return false if it's not open.
+  */
+  bool open(int curt_fd) {
+    int flags = fcntl(curt_fd, F_GETFD);
+    if (flags == -1) {
+      return false;
+    }
+    fcntl(curt_fd, F_SETFD, flags | FD_CLOEXEC);
+    fd = curt_fd;
+    owner = getpid();
+    pending.reserve(STATUS_BATCH_BYTES * 2);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    epoch = now.tv_sec + now.tv_nsec / 1e9 - monotonicSeconds();
+    return true;
+  }
+
+  /*
+    Add record of a process that terminated with wstatus, it started at monotonic time started.
+  */
+  void add(int job,
+           pid_t pid,
+           const std::string & argv0,
+           int wstatus,
+           double started,
+           double real,
+           const struct rusage & usage) {
+    if (fd == -1) {
+      return;
+    }
+    int signal = WIFSIGNALED(wstatus) ? WTERMSIG(wstatus) : 0;
+    int status = signal != 0 ? 128 + signal : WEXITSTATUS(wstatus);
+
+    char number[64];
+    snprintf(number, sizeof(number), "{\"job\":%d,\"pid\":%d,\"argv0\":", job, (int)pid);
+    pending += number;
+    appendJsonString(pending, argv0);
+    snprintf(number, sizeof(number), ",\"status\":%d,\"signal\":%d", status, signal);
+    pending += number;
+    snprintf(number, sizeof(number), ",\"start\":%.6f,\"real\":%.6f", epoch + started, real);
+    pending += number;
+    snprintf(number,
+             sizeof(number),
+             ",\"user\":%.6f,\"sys\":%.6f",
+             usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+             usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+    pending += number;
+    snprintf(number, sizeof(number), ",\"maxrss\":%ld}\n", (long)usage.ru_maxrss);
+    pending += number;
+
+    double now = monotonicSeconds();
+    if (oldest == 0) {
+      oldest = now;
+    }
+    if (pending.size() >= STATUS_BATCH_BYTES || now - oldest >= STATUS_BATCH_MS / 1e3) {
+      flush();
+    }
+  }
+
+  /*
+    Get milliseconds shell may wait before pending records must be written, -1 if none is.
+  */
+  int flushTimeout() const {
+    if (pending.empty()) {
+      return -1;
+    }
+    double left = oldest + STATUS_BATCH_MS / 1e3 - monotonicSeconds();
+    return left <= 0 ? 0 : static_cast<int>(left * 1e3) + 1;
+  }
+
+  /*
+    Write every pending record with as few write() calls as possible.
+  */
+  void flush() {
+    if (pending.empty() || owner != getpid()) {
+      return;
+    }
+    size_t done = 0;
+    while (done < pending.size()) {
+      ssize_t len = write(fd, pending.data() + done, pending.size() - done);
+      if (len == -1 && errno == EINTR) {
+        continue;
+      }
+      if (len <= 0) { /* reader went away, records are dropped */
+        break;
+      }
+      done += len;
+    }
+    pending.clear();
+    oldest = 0;
+  }
+};
+
+// global variable stores command records for programs driving shell, off unless asked
+StatusStream status_stream;
+
+/*
+  Get stream "Program exited with status" and job messages are printed to. When records go to
+  their own descriptor it's stderr, so stdout has only what commands print.
+*/
+std::ostream & reportOutput() {
+  return status_stream.on() ? std::cerr : std::cout;
+}
+
+#endif
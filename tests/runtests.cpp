@@ -0,0 +1,365 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define CASE_TIMEOUT 10 /* seconds a case may run before it's killed */
+
+/*
+  One golden test: NAME.in is typed into myShell, NAME.out and NAME.err are what it must print.
+  NAME.env, if there is one, has a line NAME=value for each variable to add to its environment.
+  NAME.args, if there is one, has a line for each argument of myShell, and descriptor 3 is then
+  open for writing; NAME.status is what myShell must write there, times and pids left out.
+*/
+struct TestCase {
+  std::string name;     // file name without ".in"
+  std::string root;     // temporary directory holding work directory and output
+  pid_t pid;            // myShell running the case, -1 before it starts
+  int wstatus;          // how myShell terminated
+  std::string out;      // what myShell printed to stdout
+  std::string err;      // what myShell printed to stderr
+  std::string status;   // what myShell wrote to descriptor 3, with times and pids masked
+
+  TestCase(const std::string & curt_name) :
+      name(curt_name),
+      root(),
+      pid(-1),
+      wstatus(0),
+      out(),
+      err(),
+      status() {}
+};
+
+/*
+  Get current time of monotonic clock in seconds.
+*/
+double nowSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+  Read whole file, empty string if it doesn't exist.
+*/
+std::string readFile(const std::string & path) {
+  std::ifstream in(path.c_str(), std::ios::binary);
+  std::ostringstream content;
+  content << in.rdbuf();
+  return content.str();
+}
+
+/*
+  Write whole file, return false on failure.
+*/
+bool writeFile(const std::string & path, const std::string & content) {
+  std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+  out << content;
+  return out.good();
+}
+
+/*
+  Read every non-empty line of file, none if it doesn't exist.
+*/
+std::vector<std::string> readLines(const std::string & path) {
+  std::vector<std::string> lines;
+  std::istringstream in(readFile(path));
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty()) {
+      lines.push_back(line);
+    }
+  }
+  return lines;
+}
+
+int removeEntry(const char * path, const struct stat *, int, struct FTW *) {
+  return remove(path);
+}
+
+/*
+  Names of every case in directory, sorted.
+*/
+std::vector<std::string> findCases(const std::string & dir) {
+  std::vector<std::string> names;
+  DIR * d = opendir(dir.c_str());
+  if (d == nullptr) {
+    return names;
+  }
+  struct dirent * entry;
+  while ((entry = readdir(d)) != nullptr) {
+    std::string file(entry->d_name);
+    if (file.size() > 3 && file.compare(file.size() - 3, 3, ".in") == 0) {
+      names.push_back(file.substr(0, file.size() - 3));
+    }
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+/*
+  Start myShell on one case in a new empty directory, with stdin from case file and
+  a fixed environment, so output doesn't depend on who runs it or where. Only
+  MYSHELL_LAUNCH is passed through, so the same cases check every way of starting programs.
+*/
+bool startCase(TestCase & test, const std::string & shell, const std::string & dir) {
+  char root[] = "/tmp/myshell-test.XXXXXX";
+  if (mkdtemp(root) == nullptr) {
+    std::cerr << "mkdtemp: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  test.root = root;
+  std::string work = test.root + "/work";
+  mkdir(work.c_str(), 0755);
+
+  std::string input = dir + "/" + test.name + ".in";
+  std::string out = test.root + "/stdout";
+  std::string err = test.root + "/stderr";
+  std::string home = "HOME=" + work;
+  const char * launch = getenv("MYSHELL_LAUNCH");
+  std::string launch_mode = std::string("MYSHELL_LAUNCH=") + (launch == nullptr ? "" : launch);
+  std::vector<char *> envp;
+  envp.push_back(const_cast<char *>("PATH=/bin:/usr/bin"));
+  envp.push_back(const_cast<char *>("PS1=myShell$ "));
+  envp.push_back(const_cast<char *>("LC_ALL=C"));
+  envp.push_back(&home[0]);
+  if (launch != nullptr) {
+    envp.push_back(&launch_mode[0]);
+  }
+  std::vector<std::string> extra = readLines(dir + "/" + test.name + ".env");
+  for (size_t k = 0; k < extra.size(); k++) {
+    envp.push_back(&extra[k][0]);
+  }
+  envp.push_back(nullptr);
+  std::vector<std::string> args = readLines(dir + "/" + test.name + ".args");
+  std::string status = test.root + "/status";
+  std::vector<char *> argv;
+  argv.push_back(const_cast<char *>(shell.c_str()));
+  for (size_t k = 0; k < args.size(); k++) {
+    argv.push_back(&args[k][0]);
+  }
+  argv.push_back(nullptr);
+
+  test.pid = fork();
+  if (test.pid == 0) {
+    int in_fd = open(input.c_str(), O_RDONLY);
+    int out_fd = open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int err_fd = open(err.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (in_fd == -1 || out_fd == -1 || err_fd == -1 || chdir(work.c_str()) == -1) {
+      _exit(126);
+    }
+    dup2(in_fd, STDIN_FILENO);
+    dup2(out_fd, STDOUT_FILENO);
+    dup2(err_fd, STDERR_FILENO);
+    if (!args.empty()) {
+      int status_fd = open(status.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (status_fd == -1 || dup2(status_fd, 3) == -1) {
+        _exit(126);
+      }
+    }
+    setsid();  // no controlling terminal, and a process group to kill on timeout
+    alarm(CASE_TIMEOUT);
+    execve(shell.c_str(), &argv[0], &envp[0]);
+    _exit(127);
+  }
+  if (test.pid == -1) {
+    std::cerr << "fork: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/*
+  Replace values that differ from run to run in status records by N: times, memory used,
+  and pids of programs (0 and -1 are kept, they tell built-in and not started).
+*/
+std::string maskStatus(const std::string & records) {
+  static const std::regex varying("\"(start|real|user|sys|maxrss)\":[0-9.]+");
+  static const std::regex pid("\"pid\":[1-9][0-9]*");
+  return std::regex_replace(std::regex_replace(records, varying, "\"$1\":N"), pid, "\"pid\":N");
+}
+
+/*
+  Take output of a finished case and remove its directory.
+*/
+void finishCase(TestCase & test, int wstatus) {
+  test.wstatus = wstatus;
+  test.out = readFile(test.root + "/stdout");
+  test.err = readFile(test.root + "/stderr");
+  test.status = maskStatus(readFile(test.root + "/status"));
+  kill(-test.pid, SIGKILL);  // programs left running by the case
+  nftw(test.root.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/*
+  Show how actual output differs from golden file using diff.
+*/
+void showDiff(const std::string & golden, const std::string & actual) {
+  char path[] = "/tmp/myshell-actual.XXXXXX";
+  int fd = mkstemp(path);
+  if (fd == -1) {
+    return;
+  }
+  close(fd);
+  writeFile(path, actual);
+  std::string expected = access(golden.c_str(), R_OK) == 0 ? golden : "/dev/null";
+  std::cout.flush();
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("diff", "diff", "-u", expected.c_str(), path, (char *)nullptr);
+    _exit(127);
+  }
+  int wstatus;
+  waitpid(pid, &wstatus, 0);
+  unlink(path);
+}
+
+/*
+  Compare case with its golden files, or write them when updating.
+  Return true if case passed.
+*/
+bool checkCase(TestCase & test, const std::string & dir, bool update) {
+  std::string out_path = dir + "/" + test.name + ".out";
+  std::string err_path = dir + "/" + test.name + ".err";
+  std::string status_path = dir + "/" + test.name + ".status";
+  if (WIFSIGNALED(test.wstatus)) {
+    std::cout << "FAIL " << test.name << ": killed by signal " << WTERMSIG(test.wstatus)
+              << (WTERMSIG(test.wstatus) == SIGALRM ? " (timed out)" : "") << "\n";
+    return false;
+  }
+
+  if (update) {
+    writeFile(out_path, test.out);
+    if (test.err.empty()) {
+      unlink(err_path.c_str());
+    }
+    else {
+      writeFile(err_path, test.err);
+    }
+    if (test.status.empty()) {
+      unlink(status_path.c_str());
+    }
+    else {
+      writeFile(status_path, test.status);
+    }
+    std::cout << "updated " << test.name << "\n";
+    return true;
+  }
+
+  bool same_out = test.out == readFile(out_path);
+  bool same_err = test.err == readFile(err_path);
+  bool same_status = test.status == readFile(status_path);
+  if (same_out && same_err && same_status) {
+    return true;
+  }
+  std::cout << "FAIL " << test.name << "\n";
+  if (!same_out) {
+    showDiff(out_path, test.out);
+  }
+  if (!same_err) {
+    showDiff(err_path, test.err);
+  }
+  if (!same_status) {
+    showDiff(status_path, test.status);
+  }
+  return false;
+}
+
+/*
+  Run golden tests: every NAME.in in case directory is typed into myShell, output must be the
+  same as NAME.out and NAME.err. Cases run at the same time, one per core by default.
+  Usage: runtests [-u] [-j jobs] myShell casedir
+  -u writes output of every case as its golden files instead of comparing.
+*/
+int main(int argc, char ** argv) {
+  bool update = false;
+  long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; i++) {
+    std::string option(argv[i]);
+    if (option == "-u") {
+      update = true;
+    }
+    else if (option == "-j" && i + 1 < argc) {
+      jobs = atol(argv[++i]);
+    }
+    else {
+      break;
+    }
+  }
+  if (argc - i != 2 || jobs <= 0) {
+    std::cerr << "usage: runtests [-u] [-j jobs] myShell casedir" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  char shell[PATH_MAX];
+  char dir[PATH_MAX];
+  if (realpath(argv[i], shell) == nullptr || realpath(argv[i + 1], dir) == nullptr) {
+    std::cerr << "runtests: " << std::strerror(errno) << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<TestCase> tests;
+  std::vector<std::string> names = findCases(dir);
+  for (size_t k = 0; k < names.size(); k++) {
+    tests.push_back(TestCase(names[k]));
+  }
+  if (tests.empty()) {
+    std::cerr << "runtests: no cases in " << dir << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // keep up to jobs cases running, start next one when any finishes
+  double start = nowSeconds();
+  size_t next = 0;
+  long running = 0;
+  while (next < tests.size() || running > 0) {
+    while (next < tests.size() && running < jobs) {
+      if (!startCase(tests[next], shell, dir)) {
+        return EXIT_FAILURE;
+      }
+      next++;
+      running++;
+    }
+    int wstatus;
+    pid_t pid = waitpid(-1, &wstatus, 0);
+    if (pid == -1) {
+      break;
+    }
+    for (size_t k = 0; k < next; k++) {
+      if (tests[k].pid == pid) {
+        finishCase(tests[k], wstatus);
+        running--;
+        break;
+      }
+    }
+  }
+
+  // report in order of names, so output is the same for any number of jobs
+  size_t failed = 0;
+  for (size_t k = 0; k < tests.size(); k++) {
+    if (!checkCase(tests[k], dir, update)) {
+      failed++;
+    }
+  }
+  std::cout << tests.size() - failed << " passed, " << failed << " failed in " << nowSeconds() - start
+            << " s\n";
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,141 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "accounting.h"
+#include "json.h"
+
+#define TRACE_EVENTS 65536 /* events kept in memory, older ones are overwritten */
+
+/* One timed phase of shell, like cutting a line into words or waiting for a job */
+struct TraceEvent {
+  const char * name;   // phase, always a string literal
+  double start;        // monotonic time phase started, in seconds
+  double duration;     // how long phase took, in seconds
+  std::string detail;  // command or program it worked on, may be empty
+};
+
+/*
+  Class for tracing phases of shell into a ring buffer in memory, written as Chrome trace event
+  JSON when shell exits, which chrome://tracing or Perfetto can show as a timeline.
+  When off, each phase costs only a check of one flag.
+*/
+class Tracer
+{
+ private:
+  std::vector<TraceEvent> events;  // ring buffer, allocated only when tracing starts
+  size_t next;                     // position of next event in ring
+  bool wrapped;                    // whether ring is full and oldest events are lost
+  bool enabled;                    // whether phases are recorded
+  std::string path;                // file JSON is written to
+  double origin;                   // time tracing started, timeline starts from 0 there
+
+ public:
+  Tracer() : events(), next(0), wrapped(false), enabled(false), path(), origin(0) {}
+
+  bool on() const { return enabled; }
+
+  /*
+    Start recording phases, they are written to curt_path by flush().
+  */
+  void start(const std::string & curt_path) {
+    path = curt_path;
+    events.resize(TRACE_EVENTS);
+    next = 0;
+    wrapped = false;
+    enabled = true;
+    origin = monotonicSeconds();
+  }
+
+  /*
+    Get time a phase starts, 0 when off so end() knows to skip it.
+  */
+  double begin() const { return enabled ? monotonicSeconds() : 0; }
+
+  /*
+    Record a phase that started at start, got from begin(), and ends now.
+  */
+  void end(const char * name, double start, const char * detail = nullptr) {
+    if (start == 0) {
+      return;
+    }
+    TraceEvent & event = events[next];
+    event.name = name;
+    event.start = start;
+    event.duration = monotonicSeconds() - start;
+    event.detail.assign(detail == nullptr ? "" : detail);
+    next++;
+    if (next == events.size()) {
+      next = 0;
+      wrapped = true;
+    }
+  }
+
+  /*
+    Write every recorded phase as Chrome trace event JSON, oldest first.
+    Return false if file cannot be written.
+  */
+  bool flush() {
+    if (!enabled) {
+      return true;
+    }
+    std::ofstream out(path.c_str(), std::ios::trunc);
+    if (!out) {
+      return false;
+    }
+
+    pid_t pid = getpid();
+    size_t count = wrapped ? events.size() : next;
+    size_t first = wrapped ? next : 0;
+    char number[64];
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (size_t i = 0; i < count; i++) {
+      const TraceEvent & event = events[(first + i) % events.size()];
+      snprintf(number,
+               sizeof(number),
+               "\"ts\":%.3f,\"dur\":%.3f",
+               (event.start - origin) * 1e6,
+               event.duration * 1e6);
+      out << (i == 0 ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\","
+          << number << ",\"pid\":" << pid << ",\"tid\":" << pid;
+      if (!event.detail.empty()) {
+        std::string detail;
+        appendJsonString(detail, event.detail);
+        out << ",\"args\":{\"detail\":" << detail << "}";
+      }
+      out << "}";
+    }
+    out << "\n]}\n";
+    return out.good();
+  }
+};
+
+/*
+  Class recording one phase from its construction until end of scope, like
+  "TraceScope scope(tracer, "lex");". Nothing is measured when tracer is off.
+*/
+class TraceScope
+{
+ private:
+  Tracer & tracer;       // where phase is recorded
+  const char * name;     // phase, a string literal
+  const char * detail;   // command or program, must live until end of scope
+  double start;          // time phase started, 0 when tracer is off
+
+ public:
+  TraceScope(Tracer & curt_tracer, const char * curt_name, const char * curt_detail = nullptr) :
+      tracer(curt_tracer),
+      name(curt_name),
+      detail(curt_detail),
+      start(curt_tracer.begin()) {}
+
+  ~TraceScope() { tracer.end(name, start, detail); }
+};
+
+#endif
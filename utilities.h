@@ -0,0 +1,665 @@
+#ifndef UTILITIES_H
+#define UTILITIES_H
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+  Utilities run inside the shell instead of starting a program, they behave like the programs
+  of the same name. Each one gets its arguments ending with nullptr, args[0] is its name, and
+  returns its exit status.
+*/
+
+/*
+  Append character given by escape sequence starting at s[i], which is after '\', and move i to
+  its last character. octal_zero is true for "%b" of printf and "echo -e", where octal needs '0'
+  first like "\0101". Return false for "\c", which stops all output.
+*/
+bool appendEscape(std::string & out, const char * s, size_t & i, bool octal_zero) {
+  char c = s[i];
+  switch (c) {
+    case '\\': out += '\\'; return true;
+    case 'a': out += '\a'; return true;
+    case 'b': out += '\b'; return true;
+    case 'c': return false;
+    case 'e': out += '\033'; return true;
+    case 'f': out += '\f'; return true;
+    case 'n': out += '\n'; return true;
+    case 'r': out += '\r'; return true;
+    case 't': out += '\t'; return true;
+    case 'v': out += '\v'; return true;
+    case '"': out += '"'; return true;
+    default: break;
+  }
+
+  if (c == 'x' && isxdigit((unsigned char)s[i + 1])) { /* up to 2 hex digits */
+    int value = 0;
+    for (int n = 0; n < 2 && isxdigit((unsigned char)s[i + 1]); n++) {
+      char h = s[++i];
+      value = value * 16 + (isdigit((unsigned char)h) ? h - '0' : (tolower(h) - 'a' + 10));
+    }
+    out += (char)value;
+    return true;
+  }
+  if (c >= '0' && c <= '7') { /* up to 3 octal digits, one more if first is '0' */
+    int value = 0;
+    int digits = octal_zero && c == '0' ? 4 : 3;
+    i--;
+    for (int n = 0; n < digits && s[i + 1] >= '0' && s[i + 1] <= '7'; n++) {
+      value = value * 8 + (s[++i] - '0');
+    }
+    out += (char)value;
+    return true;
+  }
+
+  // not an escape, keep both characters
+  out += '\\';
+  out += c;
+  return true;
+}
+
+/*
+  "echo" utility: print arguments separated by spaces and a newline.
+  Like /bin/echo, -n leaves out newline, -e handles escapes like "\t" and -E doesn't.
+*/
+int utilityEcho(char ** args, std::ostream & out) {
+  bool newline = true;
+  bool escapes = false;
+  size_t i = 1;
+  for (; args[i] != nullptr && args[i][0] == '-' && args[i][1] != 0; i++) {
+    if (std::strspn(args[i] + 1, "neE") != std::strlen(args[i] + 1)) { /* not an option, print it */
+      break;
+    }
+    for (const char * p = args[i] + 1; *p != 0; p++) {
+      if (*p == 'n')
+        newline = false;
+      else
+        escapes = *p == 'e';
+    }
+  }
+
+  std::string line;
+  for (size_t first = i; args[i] != nullptr; i++) {
+    if (i > first) {
+      line += ' ';
+    }
+    if (!escapes) {
+      line += args[i];
+      continue;
+    }
+    for (size_t k = 0; args[i][k] != 0; k++) {
+      if (args[i][k] != '\\' || args[i][k + 1] == 0) {
+        line += args[i][k];
+      }
+      else if (!appendEscape(line, args[i], ++k, true)) { /* "\c", nothing more */
+        out << line;
+        return EXIT_SUCCESS;
+      }
+    }
+  }
+  if (newline) {
+    line += '\n';
+  }
+  out << line;
+  return EXIT_SUCCESS;
+}
+
+/*
+  Class for "printf" utility, format is used again while arguments are left.
+  Output is kept and printed at once, or before an error so they come in order.
+*/
+class PrintfFormatter
+{
+ private:
+  const char * name;      // name to show in errors
+  char ** args;           // arguments after format, ending with nullptr
+  size_t next;            // next argument to use
+  bool failed;            // whether an argument was not a number
+  bool stopped;           // whether "\c" stopped all output
+  std::string out;        // what is printed
+  std::ostream & stream;  // where output goes
+
+ public:
+  PrintfFormatter(const char * curt_name, char ** curt_args, std::ostream & curt_stream) :
+      name(curt_name),
+      args(curt_args),
+      next(0),
+      failed(false),
+      stopped(false),
+      out(),
+      stream(curt_stream) {}
+
+  /*
+    Print format once for every group of arguments, at least once.
+    Return exit status, 1 if format or any argument was wrong.
+  */
+  int run(const char * format) {
+    bool valid = true;
+    do {
+      size_t used = next;
+      valid = format1(format);
+      if (!valid || next == used) { /* format takes no argument, never repeat */
+        break;
+      }
+    } while (!stopped && args[next] != nullptr);
+    stream << out;
+    return failed || !valid ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+ private:
+  /*
+    Print format once. Return false if it has an invalid conversion.
+  */
+  bool format1(const char * format) {
+    for (size_t i = 0; format[i] != 0 && !stopped; i++) {
+      if (format[i] == '\\' && format[i + 1] != 0) {
+        stopped = !appendEscape(out, format, ++i, false);
+      }
+      else if (format[i] == '%' && format[i + 1] == '%') {
+        out += '%';
+        i++;
+      }
+      else if (format[i] == '%') {
+        if (!convert(format, i)) {
+          return false;
+        }
+      }
+      else {
+        out += format[i];
+      }
+    }
+    return true;
+  }
+
+  /*
+    Print one conversion like "%-8.3f" starting at format[i], move i to its last character.
+  */
+  bool convert(const char * format, size_t & i) {
+    size_t start = i++;
+    std::string spec("%");
+    while (format[i] != 0 && std::strchr("-+ #0", format[i]) != nullptr) {
+      spec += format[i++];
+    }
+    if (!takeNumber(format, i, spec)) {
+      return false;
+    }
+    if (format[i] == '.') {
+      spec += format[i++];
+      if (!takeNumber(format, i, spec)) {
+        return false;
+      }
+    }
+    while (format[i] != 0 && std::strchr("hlLjzt", format[i]) != nullptr) { /* sizes don't matter */
+      i++;
+    }
+
+    char conversion = format[i];
+    const char * arg = args[next] != nullptr ? args[next++] : nullptr;
+    char buffer[512];
+    std::string text;
+    if (conversion == 'd' || conversion == 'i') {
+      long long value = arg == nullptr ? 0 : toInteger(arg);
+      text = formatted(buffer, sizeof(buffer), spec + "ll" + conversion, value);
+    }
+    else if (conversion != 0 && std::strchr("ouxX", conversion) != nullptr) {
+      unsigned long long value = arg == nullptr ? 0 : (unsigned long long)toInteger(arg);
+      text = formatted(buffer, sizeof(buffer), spec + "ll" + conversion, value);
+    }
+    else if (conversion != 0 && std::strchr("fFeEgGaA", conversion) != nullptr) {
+      long double value = arg == nullptr ? 0 : toFloat(arg);
+      text = formatted(buffer, sizeof(buffer), spec + "L" + conversion, value);
+    }
+    else if (conversion == 'c') { /* first character, nothing for empty argument */
+      std::string first(arg == nullptr ? "" : std::string(arg, arg[0] == 0 ? 0 : 1));
+      text = formatted(buffer, sizeof(buffer), spec + 's', first.c_str());
+    }
+    else if (conversion == 's') {
+      text = formatted(buffer, sizeof(buffer), spec + 's', arg == nullptr ? "" : arg);
+    }
+    else if (conversion == 'b') {
+      std::string expanded;
+      for (size_t k = 0; arg != nullptr && arg[k] != 0 && !stopped; k++) {
+        if (arg[k] == '\\' && arg[k + 1] != 0) {
+          stopped = !appendEscape(expanded, arg, ++k, true);
+        }
+        else {
+          expanded += arg[k];
+        }
+      }
+      text = formatted(buffer, sizeof(buffer), spec + 's', expanded.c_str());
+    }
+    else if (conversion == 'q') {
+      text = formatted(buffer, sizeof(buffer), spec + 's', quoted(arg == nullptr ? "" : arg).c_str());
+    }
+    else {
+      error() << "%" << std::string(format + start + 1, format[i] == 0 ? i - start - 1 : i - start)
+              << ": invalid conversion specification\n";
+      return false;
+    }
+    out += text;
+    return true;
+  }
+
+  /*
+    Print what was kept so far, then start an error message.
+  */
+  std::ostream & error() {
+    stream << out;
+    out.clear();
+    stream.flush();
+    return std::cerr << name << ": ";
+  }
+
+  /*
+    Argument quoted so a shell reads it back as it is, like "%q" of bash.
+  */
+  static std::string quoted(const std::string & arg) {
+    if (!arg.empty() && arg.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                              "0123456789_./:=+@%,-") == std::string::npos) {
+      return arg;
+    }
+    std::string answer("'");
+    for (size_t i = 0; i < arg.size(); i++) {
+      answer += arg[i] == '\'' ? "'\\''" : std::string(1, arg[i]);
+    }
+    return answer + "'";
+  }
+
+  /*
+    Copy width or precision into spec, "*" takes it from next argument.
+  */
+  bool takeNumber(const char * format, size_t & i, std::string & spec) {
+    if (format[i] == '*') {
+      const char * arg = args[next] != nullptr ? args[next++] : nullptr;
+      spec += std::to_string(arg == nullptr ? 0 : toInteger(arg));
+      i++;
+      return true;
+    }
+    while (isdigit((unsigned char)format[i])) {
+      spec += format[i++];
+    }
+    return true;
+  }
+
+  /*
+    snprintf with format made at run time, long output gets a bigger buffer.
+  */
+  template <typename T>
+  std::string formatted(char * buffer, size_t size, const std::string & spec, T value) {
+    int len = snprintf(buffer, size, spec.c_str(), value);
+    if (len < 0) {
+      return "";
+    }
+    if ((size_t)len < size) {
+      return std::string(buffer, len);
+    }
+    std::vector<char> bigger(len + 1);
+    snprintf(&bigger[0], bigger.size(), spec.c_str(), value);
+    return std::string(&bigger[0], len);
+  }
+
+  /*
+    Argument as integer, "'a" is code of 'a'. Wrong numbers print an error and count as far as read.
+  */
+  long long toInteger(const char * arg) {
+    if (arg[0] == '\'' || arg[0] == '"') {
+      return (unsigned char)arg[1];
+    }
+    errno = 0;
+    char * end;
+    long long value = arg[0] == '-' ? strtoll(arg, &end, 0) : (long long)strtoull(arg, &end, 0);
+    checkConverted(arg, end);
+    return value;
+  }
+
+  long double toFloat(const char * arg) {
+    if (arg[0] == '\'' || arg[0] == '"') {
+      return (unsigned char)arg[1];
+    }
+    errno = 0;
+    char * end;
+    long double value = strtold(arg, &end);
+    checkConverted(arg, end);
+    return value;
+  }
+
+  void checkConverted(const char * arg, const char * end) {
+    if (end == arg) {
+      error() << "'" << arg << "': expected a numeric value\n";
+      failed = true;
+    }
+    else if (*end != 0) {
+      error() << "'" << arg << "': value not completely converted\n";
+      failed = true;
+    }
+    else if (errno == ERANGE) {
+      error() << "'" << arg << "': " << std::strerror(errno) << "\n";
+      failed = true;
+    }
+  }
+};
+
+/*
+  "printf" utility: print format with arguments put into its conversions, like /bin/printf.
+*/
+int utilityPrintf(char ** args, std::ostream & out) {
+  if (args[1] == nullptr) {
+    std::cerr << args[0] << ": missing operand\n";
+    std::cerr << "Try '" << args[0] << " --help' for more information.\n";
+    return EXIT_FAILURE;
+  }
+  PrintfFormatter formatter(args[0], args + 2, out);
+  return formatter.run(args[1]);
+}
+
+/*
+  Class for "test" and "[" utility. Up to 4 arguments follow the POSIX rules by number of
+  arguments, more are parsed as expression with "!", "-a", "-o" and parentheses.
+*/
+class TestExpression
+{
+ private:
+  const char * name;               // "test" or "[", to show in errors
+  std::vector<const char *> args;  // arguments without name and "]"
+  size_t pos;                      // next argument to parse
+  std::string error;               // first error found, empty if none
+
+ public:
+  TestExpression(const char * curt_name, char ** curt_args, size_t count) :
+      name(curt_name),
+      args(curt_args, curt_args + count),
+      pos(0),
+      error() {}
+
+  /*
+    Return 0 if expression is true, 1 if false, 2 with message printed if it's wrong.
+  */
+  int evaluate() {
+    bool result = byCount(0, args.size());
+    if (error.empty() && pos < args.size()) {
+      error = std::string("extra argument '") + args[pos] + "'";
+    }
+    if (!error.empty()) {
+      std::cerr << name << ": " << error << "\n";
+      return 2;
+    }
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+ private:
+  /*
+    Evaluate count arguments from first, by POSIX rules when there are at most 4.
+  */
+  bool byCount(size_t first, size_t count) {
+    pos = first;
+    if (count == 0) {
+      return false;
+    }
+    const char * a = args[first];
+    if (count == 1) {
+      pos++;
+      return a[0] != 0;
+    }
+    if (count == 2) {
+      if (std::strcmp(a, "!") == 0) {
+        return !byCount(first + 1, 1);
+      }
+      if (isUnary(a)) {
+        pos += 2;
+        return unary(a, args[first + 1]);
+      }
+      if (a[0] == '-' && a[1] != 0 && a[2] == 0) {
+        setError(std::string("'") + a + "': unary operator expected");
+      }
+      else {
+        missing();
+      }
+      return false;
+    }
+    else if (count == 3) {
+      if (isBinary(args[first + 1])) {
+        pos += 3;
+        return binary(a, args[first + 1], args[first + 2]);
+      }
+      if (std::strcmp(args[first + 1], "-a") == 0 || std::strcmp(args[first + 1], "-o") == 0) {
+        pos += 3;
+        bool left = a[0] != 0;
+        bool right = args[first + 2][0] != 0;
+        return args[first + 1][1] == 'a' ? left && right : left || right;
+      }
+      if (std::strcmp(a, "!") == 0) {
+        return !byCount(first + 1, 2);
+      }
+      if (std::strcmp(a, "(") == 0 && std::strcmp(args[first + 2], ")") == 0) {
+        bool result = byCount(first + 1, 1);
+        pos++;
+        return result;
+      }
+      setError(std::string("'") + args[first + 1] + "': binary operator expected");
+      return false;
+    }
+    else if (count == 4) {
+      if (std::strcmp(a, "!") == 0) {
+        return !byCount(first + 1, 3);
+      }
+      if (std::strcmp(a, "(") == 0 && std::strcmp(args[first + 3], ")") == 0) {
+        bool result = byCount(first + 1, 2);
+        pos++;
+        return result;
+      }
+    }
+    return orExpression();
+  }
+
+  bool orExpression() {
+    bool result = andExpression();
+    while (error.empty() && pos < args.size() && std::strcmp(args[pos], "-o") == 0) {
+      pos++;
+      result = andExpression() || result;
+    }
+    return result;
+  }
+
+  bool andExpression() {
+    bool result = notExpression();
+    while (error.empty() && pos < args.size() && std::strcmp(args[pos], "-a") == 0) {
+      pos++;
+      result = notExpression() && result;
+    }
+    return result;
+  }
+
+  bool notExpression() {
+    if (pos < args.size() && std::strcmp(args[pos], "!") == 0) {
+      pos++;
+      return !notExpression();
+    }
+    return primary();
+  }
+
+  bool primary() {
+    if (pos >= args.size()) {
+      missing();
+      return false;
+    }
+    const char * a = args[pos];
+    if (pos + 2 < args.size() && isBinary(args[pos + 1])) {
+      pos += 3;
+      return binary(a, args[pos - 2], args[pos - 1]);
+    }
+    if (std::strcmp(a, "(") == 0) {
+      pos++;
+      bool result = orExpression();
+      if (pos >= args.size()) { /* "]" was taken off, but /bin/[ tells it found it */
+        setError(std::strcmp(name, "[") == 0 ? "')' expected, found ']'" : "')' expected");
+        return false;
+      }
+      if (std::strcmp(args[pos], ")") != 0) {
+        setError(std::string("')' expected, found '") + args[pos] + "'");
+        return false;
+      }
+      pos++;
+      return result;
+    }
+    if (isUnary(a)) {
+      if (pos + 1 >= args.size()) {
+        missing();
+        return false;
+      }
+      pos += 2;
+      return unary(a, args[pos - 1]);
+    }
+    pos++;
+    return a[0] != 0;
+  }
+
+  void setError(const std::string & message) {
+    if (error.empty()) {
+      error = message;
+    }
+  }
+
+  /*
+    Expression ended too early, name last argument like /bin/test.
+  */
+  void missing() { setError(std::string("missing argument after '") + args.back() + "'"); }
+
+  static bool isUnary(const char * op) {
+    return op[0] == '-' && op[1] != 0 && op[2] == 0 && std::strchr("bcdefghknprstuwxzGLOS", op[1]) != nullptr;
+  }
+
+  static bool isBinary(const char * op) {
+    const char * ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef"};
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+      if (std::strcmp(op, ops[i]) == 0)
+        return true;
+    }
+    return false;
+  }
+
+  bool unary(const char * op, const char * arg) {
+    char c = op[1];
+    if (c == 'n')
+      return arg[0] != 0;
+    if (c == 'z')
+      return arg[0] == 0;
+    if (c == 't') {
+      long long fd = 0;
+      return toInteger(arg, fd) && isatty(fd);
+    }
+    if (c == 'r' || c == 'w' || c == 'x') {
+      return access(arg, c == 'r' ? R_OK : c == 'w' ? W_OK : X_OK) == 0;
+    }
+
+    struct stat info;
+    if ((c == 'h' || c == 'L' ? lstat(arg, &info) : stat(arg, &info)) != 0) {
+      return false;
+    }
+    switch (c) {
+      case 'b': return S_ISBLK(info.st_mode);
+      case 'c': return S_ISCHR(info.st_mode);
+      case 'd': return S_ISDIR(info.st_mode);
+      case 'e': return true;
+      case 'f': return S_ISREG(info.st_mode);
+      case 'g': return (info.st_mode & S_ISGID) != 0;
+      case 'h':
+      case 'L': return S_ISLNK(info.st_mode);
+      case 'k': return (info.st_mode & S_ISVTX) != 0;
+      case 'p': return S_ISFIFO(info.st_mode);
+      case 's': return info.st_size > 0;
+      case 'S': return S_ISSOCK(info.st_mode);
+      case 'u': return (info.st_mode & S_ISUID) != 0;
+      case 'G': return info.st_gid == getegid();
+      case 'O': return info.st_uid == geteuid();
+      default: return false;
+    }
+  }
+
+  bool binary(const char * left, const char * op, const char * right) {
+    if (std::strcmp(op, "=") == 0 || std::strcmp(op, "==") == 0)
+      return std::strcmp(left, right) == 0;
+    if (std::strcmp(op, "!=") == 0)
+      return std::strcmp(left, right) != 0;
+    if (std::strcmp(op, "<") == 0)
+      return std::strcmp(left, right) < 0;
+    if (std::strcmp(op, ">") == 0)
+      return std::strcmp(left, right) > 0;
+
+    if (std::strcmp(op, "-nt") == 0 || std::strcmp(op, "-ot") == 0 || std::strcmp(op, "-ef") == 0) {
+      struct stat a, b;
+      bool has_a = stat(left, &a) == 0;
+      bool has_b = stat(right, &b) == 0;
+      if (op[1] == 'e')
+        return has_a && has_b && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+      if (!has_a || !has_b)
+        return op[1] == 'n' ? has_a : has_b;
+      bool newer = a.st_mtim.tv_sec != b.st_mtim.tv_sec ? a.st_mtim.tv_sec > b.st_mtim.tv_sec
+                                                         : a.st_mtim.tv_nsec > b.st_mtim.tv_nsec;
+      bool older = a.st_mtim.tv_sec != b.st_mtim.tv_sec ? a.st_mtim.tv_sec < b.st_mtim.tv_sec
+                                                        : a.st_mtim.tv_nsec < b.st_mtim.tv_nsec;
+      return op[1] == 'n' ? newer : older;
+    }
+
+    long long a = 0, b = 0;
+    if (!toInteger(left, a) || !toInteger(right, b)) {
+      return false;
+    }
+    if (std::strcmp(op, "-eq") == 0)
+      return a == b;
+    if (std::strcmp(op, "-ne") == 0)
+      return a != b;
+    if (std::strcmp(op, "-lt") == 0)
+      return a < b;
+    if (std::strcmp(op, "-le") == 0)
+      return a <= b;
+    if (std::strcmp(op, "-gt") == 0)
+      return a > b;
+    return a >= b;
+  }
+
+  /*
+    Read decimal integer with optional spaces around, set error if it's not one.
+  */
+  bool toInteger(const char * arg, long long & value) {
+    errno = 0;
+    char * end;
+    value = strtoll(arg, &end, 10);
+    while (*end == ' ' || *end == '\t') {
+      end++;
+    }
+    if (end == arg || *end != 0 || errno == ERANGE) {
+      setError(std::string("invalid integer '") + arg + "'");
+      return false;
+    }
+    return true;
+  }
+};
+
+/*
+  "test" utility, and "[" when bracket is true which needs "]" as last argument.
+*/
+int utilityTest(char ** args, bool bracket) {
+  size_t count = 0;
+  while (args[count + 1] != nullptr) {
+    count++;
+  }
+  if (bracket) {
+    if (count == 0 || std::strcmp(args[count], "]") != 0) {
+      std::cerr << "[: missing ']'\n";
+      return 2;
+    }
+    count--;
+  }
+  TestExpression expression(args[0], args + 1, count);
+  return expression.evaluate();
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef VARTABLE_H
+#define VARTABLE_H
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "decimal.h"
+
+/*
+  Class for variables given by "set", names made of letters, digits and '_' are also kept
+  in a trie, so the longest name after '$' is found in one forward scan without copying.
+*/
+class VarTable
+{
+ private:
+  enum { NAME_CHARS = 63 };  // letters, digits and '_'
+
+  /* One node of trie, one child for each character a name may have */
+  struct Node {
+    int child[NAME_CHARS];      // index of child node, 0 if none since root is never a child
+    const std::string * value;  // value of variable whose name ends here, nullptr if none
+
+    Node() : value(nullptr) { std::memset(child, 0, sizeof(child)); }
+  };
+
+  std::unordered_map<std::string, Decimal> table;  // name -> value, values never move
+  std::vector<Node> nodes;                         // trie, nodes[0] is root
+
+ public:
+  VarTable() : table(), nodes(1) {}
+
+  /*
+    Set variable, add its name to trie if it's new.
+  */
+  void set(const std::string & key, const std::string & value) {
+    std::pair<std::unordered_map<std::string, Decimal>::iterator, bool> result =
+        table.insert(std::make_pair(key, Decimal(value)));
+    if (!result.second) { /* exists, value stays at the same place */
+      result.first->second.assign(value);
+      return;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < key.size(); i++) {
+      int c = charIndex(key[i]);
+      if (c < 0) { /* cannot appear after '$', no need to find it */
+        return;
+      }
+      if (nodes[n].child[c] == 0) {
+        nodes[n].child[c] = nodes.size();
+        nodes.push_back(Node());
+      }
+      n = nodes[n].child[c];
+    }
+    nodes[n].value = &result.first->second.str();
+  }
+
+  /*
+    Remove variable, its name stays in trie but matches nothing.
+  */
+  void unset(const std::string & key) {
+    if (table.erase(key) == 0) {
+      return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < key.size(); i++) {
+      int c = charIndex(key[i]);
+      if (c < 0 || nodes[n].child[c] == 0) {
+        return;
+      }
+      n = nodes[n].child[c];
+    }
+    nodes[n].value = nullptr;
+  }
+
+  /*
+    Get value of variable, nullptr if not set.
+  */
+  const std::string * get(const std::string & key) const {
+    std::unordered_map<std::string, Decimal>::const_iterator it = table.find(key);
+    return it == table.end() ? nullptr : &it->second.str();
+  }
+
+  /*
+    Get variable to change as a number in place, nullptr if not set.
+  */
+  Decimal * number(const std::string & key) {
+    std::unordered_map<std::string, Decimal>::iterator it = table.find(key);
+    return it == table.end() ? nullptr : &it->second;
+  }
+
+  /*
+    Find the longest variable name at the start of name.
+    Return its value and set length to its length, or nullptr if no name matches.
+  */
+  const std::string * longestMatch(const char * name, size_t & length) const {
+    const std::string * found = nullptr;
+    size_t n = 0;
+    for (size_t i = 0; name[i] != 0; i++) {
+      int c = charIndex(name[i]);
+      if (c < 0 || nodes[n].child[c] == 0) { /* no longer name can match */
+        break;
+      }
+      n = nodes[n].child[c];
+      if (nodes[n].value != nullptr) {
+        found = nodes[n].value;
+        length = i + 1;
+      }
+    }
+    return found;
+  }
+
+  /*
+    Find variable whose name is exactly the first length characters of name, nullptr if none.
+  */
+  const std::string * exactMatch(const char * name, size_t length) const {
+    size_t n = 0;
+    for (size_t i = 0; i < length; i++) {
+      int c = charIndex(name[i]);
+      if (c < 0 || nodes[n].child[c] == 0) {
+        return nullptr;
+      }
+      n = nodes[n].child[c];
+    }
+    return nodes[n].value;
+  }
+
+ private:
+  /*
+    Position of character among children, -1 if it cannot be in a name.
+  */
+  static int charIndex(char c) {
+    if (c >= 'a' && c <= 'z')
+      return c - 'a';
+    if (c >= 'A' && c <= 'Z')
+      return 26 + c - 'A';
+    if (c >= '0' && c <= '9')
+      return 52 + c - '0';
+    if (c == '_')
+      return 62;
+    return -1;
+  }
+};
+
+#endif
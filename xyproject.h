@@ -1,57 +1,217 @@
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
-#define PATH_LEN 256 /* fixed length to use getcwd() */
+#include "accounting.h"
+#include "commandcache.h"
+#include "control.h"
+#include "decimal.h"
+#include "editor.h"
+#include "envstore.h"
+#include "history.h"
+#include "jobs.h"
+#include "launch.h"
+#include "lexer.h"
+#include "parallel.h"
+#include "prompt.h"
+#include "scriptinput.h"
+#include "statusstream.h"
+#include "trace.h"
+#include "utilities.h"
+#include "vartable.h"
+
+/* Built-in instructions, those from BUILTIN_ECHO on are utilities reported like programs */
+enum BuiltinKind {
+  BUILTIN_CD,
+  BUILTIN_SET,
+  BUILTIN_EXPORT,
+  BUILTIN_INC,
+  BUILTIN_CALCULATE,
+  BUILTIN_HASH,
+  BUILTIN_JOBS,
+  BUILTIN_FG,
+  BUILTIN_BG,
+  BUILTIN_WAIT,
+  BUILTIN_PARALLEL,
+  BUILTIN_ACCOUNT,
+  BUILTIN_HISTORY,
+  BUILTIN_ECHO,
+  BUILTIN_PRINTF,
+  BUILTIN_TEST,
+  BUILTIN_BRACKET,
+  BUILTIN_TRUE,
+  BUILTIN_FALSE,
+  BUILTIN_PWD
+};
+
+// global variable stores all built-in instructions, found by hash of name in constant time
+const std::unordered_map<std::string, BuiltinKind> BUILTIN = {
+    {"cd", BUILTIN_CD},             {"set", BUILTIN_SET},         {"export", BUILTIN_EXPORT},
+    {"inc", BUILTIN_INC},           {"add", BUILTIN_CALCULATE},   {"sub", BUILTIN_CALCULATE},
+    {"mul", BUILTIN_CALCULATE},     {"hash", BUILTIN_HASH},       {"jobs", BUILTIN_JOBS},
+    {"fg", BUILTIN_FG},             {"bg", BUILTIN_BG},           {"wait", BUILTIN_WAIT},
+    {"parallel", BUILTIN_PARALLEL}, {"account", BUILTIN_ACCOUNT}, {"history", BUILTIN_HISTORY},
+    {"echo", BUILTIN_ECHO},         {"printf", BUILTIN_PRINTF},   {"test", BUILTIN_TEST},
+    {"[", BUILTIN_BRACKET},         {"true", BUILTIN_TRUE},       {"false", BUILTIN_FALSE},
+    {"pwd", BUILTIN_PWD}};
+
+/* Options decided when shell starts */
+struct ShellOptions {
+  LaunchMode launch_mode;  // how real commands are started
+  bool show_prompt;        // whether prompt is printed before each input
+  bool report_status;      // whether "Program exited with status" is printed
+};
+
+// global variable stores options of this shell
+ShellOptions shell_options = {LAUNCH_SPAWN, true, true};
+
+// global variable stores timed phases of shell, off unless MYSHELL_TRACE or "-t" asks
+Tracer tracer;
 
-// global variable stores all built-in instructions
-const std::vector<std::string> BUILTIN = {"cd", "set", "export", "inc"};
+// global variable stores lines typed, in a file shared with other shells, none when running script
+History shell_history;
 
 // several function prototype for class use
-std::vector<char *> input2Args(std::string & input);
-std::vector<char *> input2Args(std::string & input, std::string & modified);
-std::string findPath(std::vector<char *> paths, char * command);
-bool determineRange(char c);
-void executePath(std::string & path_found, std::vector<char *> & args, std::vector<char *> & envs);
-std::string pruneInput(std::string input);
-void printShell();
+std::string findPath(std::string & dirname, std::string & command_name, int & status);
+bool isBuiltIn(const char * name);
+bool isUtility(const char * name);
+bool printsOnly(const char * name);
+void reportStatus(int wstatus);
+void reportStatuses(std::vector<int> & statuses);
+void printShell(Prompt & prompt, EnvStore & env);
+void printContinuation(Prompt & prompt);
 
 /* Class for command, like 'cd', 'ls', etc. */
 class MyCommand
 {
  protected:
-  std::vector<char *> envs;  // stores environment variables
-  char * env_path;           // stores PATH specially
-  std::string input;         // stores user input before modified with '\\'
-  std::string modified;      // stores user input after modified
+  EnvStore & env;            // stores environment variables, shared by all commands
   std::vector<char *> args;  // stores parsed input to pass parameters for system call
+  CommandCache & cache;      // stores command name -> path table built from PATH
+  std::vector<FdAction> redirects;  // stores redirections like "> file", done by child
+  std::string redirect_error;       // stores token causing redirection syntax error
 
  public:
-  MyCommand(std::vector<char *> curt_envs, char * curt_path, std::string curt_input) :
-      envs(curt_envs),
-      env_path(curt_path),
-      input(curt_input),
-      modified(curt_input),
-      args() {
-    // use vector args to parse command line arguments
-    args = input2Args(input, modified);
+  MyCommand(EnvStore & curt_env, const LexedCommand & command, CommandCache & curt_cache) :
+      env(curt_env),
+      args(command.args, command.args + command.count + 1),
+      cache(curt_cache),
+      redirects(),
+      redirect_error() {
+
+    // take redirections out of arguments
+    parseRedirections();
   }
 
   /*
-    Execute command.
+    Find redirections "<", ">", ">>", "2>" and "2>>" in arguments, like "ls>out", "ls > out"
+    or "ls >out". They are removed from args, and done by child before exec.
    */
-  void execute() {
+  void parseRedirections() {
+    std::vector<char *> remain;
+    remain.reserve(args.size());
+    for (size_t i = 0; args[i] != nullptr; i++) {
+      char * word = args[i];
+
+      // operator may be in the middle of word, then the part before it is an argument
+      size_t pos = std::strcspn(word, "<>");
+      if (word[pos] == 0) { /* normal argument */
+        remain.push_back(word);
+        continue;
+      }
+      if (pos == 1 && word[0] == '2' && word[1] == '>') { /* "2>" is one operator */
+        pos = 0;
+      }
+      std::string op(word + pos);
+      if (pos > 0) {
+        word[pos] = 0;
+        remain.push_back(word);
+      }
+
+      // decide which descriptor and how to open by the operator
+      int fd;
+      int flags;
+      size_t len;
+      if (op.compare(0, 3, "2>>") == 0) {
+        fd = STDERR_FILENO;
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+        len = 3;
+      }
+      else if (op.compare(0, 2, "2>") == 0) {
+        fd = STDERR_FILENO;
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+        len = 2;
+      }
+      else if (op.compare(0, 2, ">>") == 0) {
+        fd = STDOUT_FILENO;
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+        len = 2;
+      }
+      else if (op[0] == '>') {
+        fd = STDOUT_FILENO;
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+        len = 1;
+      }
+      else {
+        fd = STDIN_FILENO;
+        flags = O_RDONLY;
+        len = 1;
+      }
+
+      // file name follows operator directly, or is the next word
+      std::string target = op.substr(len);
+      if (target == "") {
+        if (args[i + 1] == nullptr) {
+          redirect_error = "newline";
+          break;
+        }
+        target = args[++i];
+      }
+      if (target[0] == '<' || target[0] == '>') {
+        redirect_error = target;
+        break;
+      }
+      redirects.push_back(FdAction(fd, target, flags));
+    }
+    remain.push_back(nullptr);
+    args = remain;
+  }
+
+  /*
+    Check redirections parsed well, otherwise print syntax error.
+   */
+  bool redirectionValid() {
+    if (redirect_error != "") {
+      std::cerr << "syntax error near unexpected token `" << redirect_error << "'\n";
+      return false;
+    }
+    return true;
+  }
+
+  /*
+    Find program of command in the parent, so the child only needs to exec.
+    Return empty string and set status to report when command cannot run.
+   */
+  std::string resolve(int & status) {
+    TraceScope scope(tracer, "lookup", args[0]);
+
     // get first word of command
     std::string first(args[0]);
 
+    // if command cannot run, child used to exit with this status
+    status = W_EXITCODE(atoi(args[0]) & 0xff, 0);
+
     // find whether '/' exists in command name
     std::size_t found = first.find("/");
 
@@ -62,142 +222,112 @@ class MyCommand
       // if '/' appears at last, command is purely a directory, which is incorrect
       if (pos == first.size() - 1) {
         std::cerr << "Invalid command: need a command not a pure directory!" << std::endl;
-        _exit(atoi(args[0]));
+        return "";
       }
-      else {
-        // seperate directory and command
-        std::string command_dir = first.substr(0, pos + 1);
-        std::string command_name = first.substr(pos + 1);
 
-        // paths store all possible paths, since provided only one
-        std::vector<char *> paths;
-        paths.push_back(&command_dir[0]);
+      // seperate directory and command
+      std::string command_dir = first.substr(0, pos + 1);
+      std::string command_name = first.substr(pos + 1);
 
-        // find the path use function findPath() & execute it
-        std::string path_found = findPath(paths, &command_name[0]);
-        executePath(path_found, args, envs);
+      // find the path use function findPath()
+      std::string path_found = findPath(command_dir, command_name, status);
+      if (path_found == "" && WEXITSTATUS(status) != EXIT_FAILURE) {
+        reportOutput() << "Command " << args[0] << " not found" << std::endl;
       }
+      return path_found;
     }
-    else { /* no path provided, search it */
-      // store all paths in vector paths
-      std::vector<char *> paths;
-      char * curt_path = std::strtok(env_path, ":");
-      while (curt_path != nullptr) {
-        paths.push_back(curt_path);
-        curt_path = std::strtok(nullptr, ":");
-      }
 
-      // find the path use function findPath() & execute it
-      std::string path_found = findPath(paths, args[0]);
-      executePath(path_found, args, envs);
+    /* no path provided, look it up in table built from PATH */
+    std::string path_found = cache.lookup(first, true);
+    if (path_found == "") {
+      reportOutput() << "Command " << args[0] << " not found" << std::endl;
     }
-
-    // don't expect return unless error
-    _exit(atoi(args[0]));
+    return path_found;
   }
 
   /*
-    Find path from environment variable PATH.
-  */
-  std::string findPath(std::vector<char *> paths, char * command) {
-    std::string answer = "";
-
-    // iterate each possible path in paths
-    for (std::vector<char *>::iterator it = paths.begin(); it != paths.end(); ++it) {
-      // open directory
-      DIR * d = opendir(*it);
-      if (!d) {
-        std::cerr << "invalid directory path." << std::endl;
-        exit(EXIT_FAILURE);
-      }
-
-      // seperate command's name itself and directory name
-      std::string command_name(command);
-      std::string dirname(*it);
-      dirname += "/";
-
-      // search command
-      struct dirent * entry;
-      while ((entry = readdir(d)) != nullptr) {
-        std::string filename(entry->d_name);
-
-        // handle . and ..
-        if (filename == "." || filename == "..")
-          continue;
-
-        // nested directory, then search into that directory
-        if (entry->d_type == DT_DIR) {
-          std::string find = findNestedPath(dirname + entry->d_name + "/", command_name);
-          if (find != "")
-            return find;
-        }
-
-        // command matches!
-        if (command_name == filename) {
-          answer += dirname + filename;  // update answer with full path
-          return answer;
-        }
-      }
+    Start command as a new process, spec may already hold descriptor changes.
+    Return pid of child, or -1 with status to report when nothing was started.
+   */
+  pid_t launch(LaunchSpec & spec, LaunchMode mode, int & status) {
+    if (!redirectionValid()) {
+      status = W_EXITCODE(2, 0);
+      return -1;
     }
 
-    // no matches, return empty string
-    return answer;
-  }
+    // redirections come after pipes, so they win like in linux shell
+    spec.actions.insert(spec.actions.end(), redirects.begin(), redirects.end());
 
-  /*
-    Helper function to find nested directory when we search command.
-   */
-  std::string findNestedPath(std::string dirname, std::string command) {
-    // answer = empty string by default
-    std::string answer;
+    if (args[0] == nullptr) { /* only redirections, like "> file", just create files */
+      std::vector<FdAction> saved;
+      status = W_EXITCODE(redirectFds(spec.actions, saved) ? EXIT_SUCCESS : EXIT_FAILURE, 0);
+      restoreFds(saved);
+      return -1;
+    }
 
-    // open directory
-    DIR * d = opendir(dirname.c_str());
-    if (!d) {
-      std::cerr << "invalid directory path." << std::endl;
-      exit(EXIT_FAILURE);
+    spec.path = resolve(status);
+    if (spec.path == "") {
+      return -1;
     }
 
-    // search command
-    struct dirent * entry;
-    while ((entry = readdir(d)) != nullptr) {
-      std::string filename(entry->d_name);
+    // update command with full path
+    spec.args = args;
+    spec.args[0] = &spec.path[0];
+    spec.envp = env.get();
+    spec.fail_status = WEXITSTATUS(status);
 
-      // handle . or ..
-      if (filename == "." || filename == "..")
-        continue;
+    // anything shell printed must come before output of program
+    std::cout.flush();
 
-      // nested directory, go into the directory and search
-      if (entry->d_type == DT_DIR)
-        return findNestedPath(dirname + entry->d_name + "/", command);
+    TraceScope scope(tracer, "spawn", spec.path.c_str());
+    pid_t pid = launchProgram(spec, mode);
+    if (pid == -1) {
+      reportLaunchError(spec);
+      status = W_EXITCODE(EXIT_FAILURE, 0);
+    }
+    return pid;
+  }
 
-      // command matches!
-      if (command == filename) {
-        answer += dirname + filename;  // update answer with full path
-        return answer;
+  /*
+    Print why program could not start. Spawn doesn't tell which file failed to open,
+    so check redirected files first and blame the program only if all of them are fine.
+   */
+  void reportLaunchError(LaunchSpec & spec) {
+    int err = errno;
+    for (size_t i = 0; i < spec.actions.size(); i++) {
+      FdAction & action = spec.actions[i];
+      if (action.from != -1) {
+        continue;
+      }
+      int fd = open(action.path.c_str(), action.flags | O_CLOEXEC, 0666);
+      if (fd == -1) {
+        std::cerr << action.path << ": " << std::strerror(errno) << std::endl;
+        return;
       }
+      close(fd);
     }
-
-    // no match, return empty string
-    return answer;
+    std::cerr << args[0] << ": " << std::strerror(err) << std::endl;
   }
 
   /*
-    Execute command according to path found, arguments and environment variables.
+    Find command in the directory given by user, no need to read the whole directory.
   */
-  void executePath(std::string & path_found,
-                   std::vector<char *> & args,
-                   std::vector<char *> & envs) {
-    if (path_found == "") { /* no match with command */
-      std::cout << "Command " << args[0] << " not found" << std::endl;
-      _exit(atoi(args[0]));
+  std::string findPath(std::string & dirname, std::string & command_name, int & status) {
+    // make sure directory exists
+    struct stat st;
+    if (stat(dirname.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+      std::cerr << "invalid directory path." << std::endl;
+      status = W_EXITCODE(EXIT_FAILURE, 0);
+      return "";
     }
-    else { /* command found in environment path */
-      // update command with full path
-      args[0] = &path_found[0];
 
-      execve(args[0], &args[0], &envs[0]);
+    // command matches only if it exists and is not a directory
+    std::string answer = dirname + command_name;
+    if (stat(answer.c_str(), &st) != 0 || S_ISDIR(st.st_mode)) {
+      answer = "";
     }
+
+    return answer;
   }
 };
 
@@ -205,34 +335,93 @@ class MyCommand
 class MyBuiltInIns : public MyCommand
 {
  private:
-  std::unordered_map<std::string, std::string> & vars;  // stores variables for set
-  std::string unmodified_input;                         // stores another unmodified input
+  VarTable & vars;    // stores variables for set
+  const char * text;  // stores command with spaces kept
+  JobTable & jobs;    // stores jobs for fg, bg, etc.
+  Prompt & prompt;    // stores current directory for cd
+  int status;         // exit status, only utilities may fail
 
  public:
-  MyBuiltInIns(std::vector<char *> curt_envs,
-               char * curt_path,
-               std::string curt_input,
-               std::unordered_map<std::string, std::string> & curt_vars) :
-      MyCommand(curt_envs, curt_path, curt_input),
+  MyBuiltInIns(EnvStore & curt_env,
+               const LexedCommand & command,
+               VarTable & curt_vars,
+               CommandCache & curt_cache,
+               JobTable & curt_jobs,
+               Prompt & curt_prompt) :
+      MyCommand(curt_env, command, curt_cache),
       vars(curt_vars),
-      unmodified_input(curt_input) {}
+      text(command.text),
+      jobs(curt_jobs),
+      prompt(curt_prompt),
+      status(EXIT_SUCCESS) {}
+
+  /*
+    Run instruction with its redirections done in the shell itself, return its exit status.
+   */
+  int run() {
+    if (!redirectionValid()) {
+      return 2;
+    }
+
+    std::vector<FdAction> saved;
+    if (redirectFds(redirects, saved)) {
+      execute();
+    }
+    else {
+      status = EXIT_FAILURE;
+    }
+    restoreFds(saved);
+    return status;
+  }
 
   // override execute
   void execute() {
-    // handle different instructions accordingly
-    std::string ins(args[0]);
-    if (ins == "cd") {
-      changePath();
+    // handle different instructions accordingly, name was checked to be in BUILTIN
+    switch (BUILTIN.find(args[0])->second) {
+      case BUILTIN_CD: changePath(); break;
+      case BUILTIN_SET: setVariable(); break;
+      case BUILTIN_EXPORT: exportVariable(); break;
+      case BUILTIN_INC: incrementVariable(); break;
+      case BUILTIN_CALCULATE: calculateVariable(); break;
+      case BUILTIN_HASH: hashCommand(); break;
+      case BUILTIN_JOBS: jobs.list(); break;
+      case BUILTIN_FG: foregroundJob(); break;
+      case BUILTIN_BG: backgroundJob(); break;
+      case BUILTIN_WAIT: waitJobs(); break;
+      case BUILTIN_PARALLEL: parallelCommand(); break;
+      case BUILTIN_ACCOUNT: accountCommand(); break;
+      case BUILTIN_HISTORY: historyCommand(); break;
+      case BUILTIN_ECHO: status = utilityEcho(&args[0], std::cout); break;
+      case BUILTIN_PRINTF: status = utilityPrintf(&args[0], std::cout); break;
+      case BUILTIN_TEST: status = utilityTest(&args[0], false); break;
+      case BUILTIN_BRACKET: status = utilityTest(&args[0], true); break;
+      case BUILTIN_TRUE: status = EXIT_SUCCESS; break;
+      case BUILTIN_FALSE: status = EXIT_FAILURE; break;
+      case BUILTIN_PWD: printDirectory(); break;
     }
-    else if (ins == "set") {
-      setVariable();
-    }
-    else if (ins == "export") {
-      exportVariable();
+  }
+
+  /*
+    "pwd" instruction, current directory kept by shell, or found again with -P.
+   */
+  void printDirectory() {
+    bool physical = false;
+    for (size_t i = 1; args[i] != nullptr && args[i][0] == '-' && args[i][1] != 0; i++) {
+      std::string option(args[i]);
+      if (option == "-P") {
+        physical = true;
+      }
+      else if (option != "-L") {
+        std::cerr << "pwd: invalid option -- '" << option.substr(1) << "'\n";
+        status = EXIT_FAILURE;
+        return;
+      }
     }
-    else if (ins == "inc") {
-      incrementVariable();
+
+    if (physical) {
+      prompt.update();
     }
+    std::cout << prompt.cwd() << "\n";
   }
 
   /*
@@ -244,7 +433,8 @@ class MyBuiltInIns : public MyCommand
         std::cerr << "Cannot redirect to HOME directory!\n";
       }
       else {
-        setenv("PWD", getenv("HOME"), 1);  // set env var "PWD"
+        prompt.update();
+        env.set("PWD", getenv("HOME"));  // set env var "PWD"
       }
     }
     else if (args.size() == 3) {         /* change by given path */
@@ -254,22 +444,21 @@ class MyBuiltInIns : public MyCommand
           std::cerr << "Cannot redirect to HOME directory!\n";
         }
         else {
-          setenv("PWD", getenv("HOME"), 1);  // set env var "PWD"
+          prompt.update();
+          env.set("PWD", getenv("HOME"));  // set env var "PWD"
         }
       }
       else if (chdir(args[1]) != 0) {
         std::cerr << "Invalid destination diretory.\n";
       }
       else {  // set env var "PWD"
-        char cwd[PATH_LEN];
-        getcwd(cwd, PATH_LEN);
-        setenv("PWD", cwd, 1);
+        prompt.update();
+        env.set("PWD", prompt.cwd().c_str());
       }
     }
     else { /* otherwise arguments fault */
       std::cerr << "cd: too many arguments\n";
     }
-    printShell();
   }
 
   /*
@@ -284,12 +473,11 @@ class MyBuiltInIns : public MyCommand
       for (size_t i = 0; i < key.size(); i++) {  // check name valid
         if (!determineRange(key[i])) {
           std::cout << "set: invalid variable name\n";
-          printShell();
           return;
         }
       }
       std::string value = "";
-      vars[key] = value;
+      vars.set(key, value);
     }
     else { /* everything provided */
       // first check if the variable name is valid
@@ -297,13 +485,13 @@ class MyBuiltInIns : public MyCommand
       for (size_t i = 0; i < var_name.size(); i++) {
         if (!determineRange(var_name[i])) {
           std::cout << "set: invalid variable name\n";
-          printShell();
           return;
         }
       }
 
       // valid variable name
       // find first non-space word
+      std::string unmodified_input(text);
       size_t pos = unmodified_input.find_first_not_of(" ");
       while (unmodified_input[pos] != ' ')
         pos++;
@@ -319,9 +507,8 @@ class MyBuiltInIns : public MyCommand
       std::string key(args[1]);
       std::string value = unmodified_input.substr(pos);
 
-      vars[key] = value;
+      vars.set(key, value);
     }
-    printShell();
   }
 
   /*
@@ -336,289 +523,392 @@ class MyBuiltInIns : public MyCommand
     }
     else {
       std::string key(args[1]);  // "key"
-      if (vars.find(key) == vars.end()) {
+      const std::string * value = vars.get(key);
+      if (value == nullptr) {
         std::cerr << "export: no variable matched\n";
       }
       else {
-        std::string value = vars[key];
-
-        if (setenv(key.c_str(), value.c_str(), 1) !=
-            0) { /* use setenv() to export and override if variable exists */
+        if (!env.set(key.c_str(),
+                     value->c_str())) { /* use setenv() to export and override if variable exists */
           std::cerr << "unable to export " << key << std::endl;
         }
       }
     }
-    printShell();
   }
 
   /*
-    Helper function for inc to determine if variable is number for "inc" instruction.
-  */
-  bool isNumber(std::string str) {
-    // if there's no number at all, return false;
-    bool hasDigit = false;
-    for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
-      if (std::isdigit(*it)) {
-        hasDigit = true;
-        break;
-      }
-    }
-
-    if (!hasDigit) { /* no nunber at all, of course return false */
-      return false;
-    }
-
-    if (!std::isdigit(str[str.size() - 1])) { /* ends with dot, like 0. 1. 3. */
-      return false;
-    }
-
-    size_t start = 0; /* mark first digit, considering possible '-' or '+' */
-    if (str[0] == '-' || str[0] == '+') {
-      start = 1;
+    "hash" instruction.
+   */
+  void hashCommand() {
+    if (args.size() == 2) { /* no argument, show commands that have run */
+      cache.print();
     }
-
-    size_t point = str.find(".");     /* mark potential . */
-    if (point != std::string::npos) { /* has . */
-      // step1: make sure everything after point is digit
-      for (size_t after = point + 1; after < str.size(); after++) {
-        if (!std::isdigit(str[after])) {
-          return false;
-        }
+    else if (std::string(args[1]) == "-r") { /* forget everything */
+      if (args.size() != 3) {
+        std::cerr << "hash: too many arguments\n";
       }
-
-      // step2: make sure everything from start to point is digit
-      for (size_t before = start; before < point; before++) {
-        if (!std::isdigit(str[before])) {
-          return false;
-        }
+      else {
+        cache.reset();
       }
     }
-    else { /* no . */
-      // from start to end must all be digit
-      for (size_t i = start; i < str.size(); i++) {
-        if (!std::isdigit(str[i])) {
-          return false;
+    else { /* show path of each given command */
+      cache.update(env.path());
+      for (size_t i = 1; args[i] != nullptr; i++) {
+        std::string path_found = cache.lookup(args[i]);
+        if (path_found == "") {
+          std::cerr << "hash: " << args[i] << ": not found\n";
+        }
+        else {
+          std::cout << args[i] << "\t" << path_found << "\n";
         }
       }
     }
-
-    return true;
   }
 
   /*
-    "inc" instruction.
+    "account" instruction, show slowest commands and commands using most memory,
+    "account on" measures every command from now on, "account off" only those run by "time".
    */
-  void incrementVariable() {
-    if (args.size() != 3) { /* invalid argument number */
-      std::cerr << "inc: please provide one valid argument\n";
+  void accountCommand() {
+    UsageLog & log = jobs.usageLog();
+    if (args.size() == 2) {
+      log.summary(std::cout);
+    }
+    else if (args.size() > 3) {
+      std::cerr << "account: too many arguments\n";
+    }
+    else if (std::string(args[1]) == "on") {
+      log.setAccounting(true);
+    }
+    else if (std::string(args[1]) == "off") {
+      log.setAccounting(false);
     }
     else {
-      // check variable exists
-      std::string key(args[1]);
-      if (vars.find(key) == vars.end()) { /* not exist, set "1" */
-        vars[key] = "1";
-      }
-      else {
-        std::string value = vars[key];
+      std::cerr << "account: " << args[1] << ": use on or off\n";
+    }
+  }
 
-        if (!isNumber(value)) { /* not a number, set "1" */
-          vars[key] = "1";
-        }
-        else { /* number, increment by 1 */
-          vars[key] = incrementNumber(value);
-        }
+  /*
+    "history" instruction, print every line of history with its number, "history n" only the
+    last n of them.
+   */
+  void historyCommand() {
+    if (args.size() == 2) {
+      shell_history.print(std::cout, -1);
+    }
+    else if (args.size() > 3) {
+      std::cerr << "history: too many arguments\n";
+    }
+    else {
+      char * end;
+      long count = strtol(args[1], &end, 10);
+      if (end == args[1] || *end != 0 || count < 0) {
+        std::cerr << "history: " << args[1] << ": numeric argument required\n";
+        return;
       }
+      shell_history.print(std::cout, count);
     }
-    printShell();
   }
 
   /*
-  Helper function to determine a number's integer part is purely zero or not
- */
-  bool onlyZero(std::string str, size_t point) {
-    // mark position of '.'
-    size_t end = point == std::string::npos ? str.size() : point;
+    "fg" instruction, continue a job in foreground and wait for it.
+   */
+  void foregroundJob() {
+    if (args.size() > 3) {
+      std::cerr << "fg: too many arguments\n";
+      return;
+    }
+    Job * job = jobs.find(args[1]);
+    if (job == nullptr) {
+      std::cerr << "fg: no such job\n";
+      return;
+    }
 
-    for (size_t i = 1; i < end; i++) {
-      if (str[i] != '0') {
-        return false;
+    std::cout << job->command << std::endl;
+    jobs.continueJob(*job, true);
+    if (jobs.waitForeground(*job)) {
+      std::vector<int> statuses;
+      for (size_t i = 0; i < job->procs.size(); i++) {
+        statuses.push_back(job->procs[i].status);
       }
+      jobs.remove(*job);
+      reportStatuses(statuses);
     }
-
-    return true;
   }
 
   /*
-   Helper function to determine a number's fraction part zero or not, input is fraction part just traverse
-  */
-  bool onlyZero(std::string str) {
-    for (size_t i = 0; i < str.size(); i++) {
-      if (str[i] != '0') {
-        return false;
-      }
+    "bg" instruction, continue a stopped job in background.
+   */
+  void backgroundJob() {
+    if (args.size() > 3) {
+      std::cerr << "bg: too many arguments\n";
+      return;
     }
-    return true;
+    Job * job = jobs.find(args[1]);
+    if (job == nullptr) {
+      std::cerr << "bg: no such job\n";
+      return;
+    }
+
+    jobs.continueJob(*job, false);
+    std::cout << "[" << job->id << "]  " << job->command << " &\n";
   }
 
   /*
-   Handle increment for string representation of number, a helper function for "inc".
-  */
-  std::string incrementNumber(std::string str) {
-    std::string answer;
-    size_t point = str.find(".");  // position of '.'
-
-    if (str[0] == '-') { /* negative */
-      if ((onlyZero(str, point) && point == std::string::npos) ||
-          (point != std::string::npos && onlyZero(str, point) &&
-           onlyZero(
-               str.substr(point + 1))))  // condition1 like -0000000 &&  condition2 like -000.0000
-        return "1";
-      else if (
-          !onlyZero(
-              str,
-              point)) {  // like -13.309, do normal minus for integer number part and concat fraction
-        size_t curt = str.size() - 1;  // mark concatenate position
-
-        if (point != std::string::npos) {  // has point, concat fraction first
-          answer += str.substr(point);
-          curt = point - 1;
-        }
-
-        bool decarry = true;  // do minus for integer part
-        while (curt > 0 && decarry) {
-          if (str[curt] == '0') {
-            answer = "9" + answer;
-          }
-          else {
-            answer = std::to_string((str[curt] - '0') - 1) + answer;
-            decarry = false;
-          }
-          curt--;
-        }
+    "wait" instruction, wait for given jobs or all background jobs to finish.
+   */
+  void waitJobs() {
+    // collect jobs to wait
+    std::vector<int> ids;
+    if (args.size() == 2) {
+      ids = jobs.backgroundIds();
+    }
+    for (size_t i = 1; args[i] != nullptr; i++) {
+      Job * job = jobs.find(args[i]);
+      if (job == nullptr) {
+        std::cerr << "wait: " << args[i] << ": no such job\n";
+      }
+      else {
+        ids.push_back(job->id);
+      }
+    }
 
-        // end condition
-        if (curt ==
-            0) {  // for numbers like -100.123, curt traversed every digit of integer and stops at '-'
-          answer = "-" + answer;
-        }
-        else {  // curt stops at intermediate digit between '-' and '.'
-          answer = str.substr(0, curt - 0 + 1) + answer;
-        }
+    // stopped jobs would never finish, don't wait for them
+    for (size_t i = 0; i < ids.size(); i++) {
+      Job * job = jobs.find(ids[i]);
+      while (job != nullptr && !job->finished() && !job->stopped()) {
+        jobs.waitEvent();
       }
-      else {  // like -0.123
-        size_t curt = str.size() - 1;
-        for (; curt > point; curt--) {  // find first non-zero from right to left
-          if (str[curt] != '0') {
-            break;
-          }
-          else {
-            answer = "0" + answer;
-          }
-        }
+      if (job != nullptr && job->finished()) {
+        jobs.remove(*job);
+      }
+    }
+  }
 
-        // handle least significant digit, use 10 to minus it
-        answer = std::to_string(10 - (str[curt] - '0')) + answer;
-        curt--;
+  /*
+    "parallel" instruction: parallel [-j N] [-a file] command [args] [::: item ...]
+    Run command once for every item, "{}" in command is replaced by item, otherwise item is
+    appended. Items come after ":::", from file given by "-a", or from stdin line by line.
+    Up to N commands run at the same time, N is number of cores by default.
+   */
+  void parallelCommand() {
+    size_t max_slots = sysconf(_SC_NPROCESSORS_ONLN);
+    const char * items_file = nullptr;
+
+    // options
+    size_t i = 1;
+    for (; args[i] != nullptr && args[i][0] == '-'; i++) {
+      std::string option(args[i]);
+      if (option.compare(0, 2, "-j") == 0 && option.size() > 2) {
+        max_slots = atoi(args[i] + 2);
+      }
+      else if (option == "-j" && args[i + 1] != nullptr) {
+        max_slots = atoi(args[++i]);
+      }
+      else if (option == "-a" && args[i + 1] != nullptr) {
+        items_file = args[++i];
+      }
+      else {
+        break;
+      }
+    }
 
-        // other fraction digits use 9 to minus, use 9 to minus it because there's decarry of lower digit
-        while (curt > point) {
-          answer = std::to_string(9 - (str[curt] - '0')) + answer;
-          curt--;
-        }
+    // command itself, spaces inside a word keep their '\'
+    size_t command_start = i;
+    std::string command;
+    for (; args[i] != nullptr && std::string(args[i]) != ":::"; i++) {
+      if (command != "") {
+        command += " ";
+      }
+      command += escapeSpaces(args[i]);
+    }
+    if (command == "") {
+      std::cerr << "parallel: no command provided\n";
+      return;
+    }
+    if (isBuiltIn(args[command_start]) && !isUtility(args[command_start])) {
+      std::cerr << "parallel: built-in instructions cannot run in parallel\n";
+      return;
+    }
 
-        // add "0."
-        answer = "0." + answer;
+    // items
+    std::vector<std::string> items;
+    if (args[i] != nullptr) { /* after ":::" */
+      for (i++; args[i] != nullptr; i++) {
+        items.push_back(args[i]);
       }
     }
-    else {                  /* positive */
-      if (str[0] == '+') {  // handle positive number with "+"
-        return "+" + incrementNumber(str.substr(1));
+    else if (items_file != nullptr) {
+      std::ifstream file(items_file);
+      if (!file) {
+        std::cerr << "parallel: " << items_file << ": " << std::strerror(errno) << "\n";
+        return;
       }
-      size_t curt = str.size() - 1;  // mark concatenate position
-
-      if (point != std::string::npos) { /* fraction */
-        answer += str.substr(point);    // copy number after point directly
-        curt = point - 1;
+      std::string line;
+      while (std::getline(file, line)) {
+        items.push_back(line);
+      }
+    }
+    else {
+      std::string line;
+      while (std::getline(std::cin, line)) {
+        items.push_back(line);
       }
+      std::cin.clear();
+    }
 
-      bool carry = true;  // initial carry with inc's 1
-      while (curt != SIZE_MAX && carry) {
-        if (str[curt] == '9') {
-          answer = "0" + answer;  // carry
-        }
-        else {
-          answer = std::to_string((str[curt] - '0') + 1) + answer;  // no carry
-          carry = false;
+    // every item becomes one command line, parsed by MyCommand like any other command
+    std::vector<std::string> lines;
+    size_t holder = command.find("{}");
+    for (size_t k = 0; k < items.size(); k++) {
+      std::string item = escapeSpaces(items[k].c_str());
+      if (holder == std::string::npos) {
+        lines.push_back(command + " " + item);
+      }
+      else {
+        std::string line(command);
+        for (size_t pos = line.find("{}"); pos != std::string::npos;
+             pos = line.find("{}", pos + item.size())) {
+          line.replace(pos, 2, item);
         }
-        curt--;
+        lines.push_back(line);
       }
+    }
 
-      if (curt == SIZE_MAX && carry) {  // still carry after all digits
-        answer = "1" + answer;
+    cache.update(env.path());
+    Lexer lexer;
+    ParallelRunner runner(jobs, max_slots);
+    size_t failed =
+        runner.run(lines, [&](size_t k, LaunchSpec & spec, int & status, std::string & name) {
+          LexedCommand & words = lexer.lexWords(lines[k]);
+          name = words.count > 0 ? words.args[0] : "";
+          MyCommand new_command(env, words, cache);
+          return new_command.launch(spec, shell_options.launch_mode, status);
+        });
+
+    if (shell_options.report_status) {
+      reportOutput() << "Parallel finished " << lines.size() << " commands, " << failed
+                     << " failed\n";
+    }
+  }
+
+  /*
+    Helper function for parallel to keep spaces inside one argument with '\'.
+   */
+  std::string escapeSpaces(const char * word) {
+    std::string answer;
+    for (const char * p = word; *p != 0; p++) {
+      if (*p == ' ') {
+        answer += '\\';
+      }
+      answer += *p;
+    }
+    return answer;
+  }
+
+  /*
+    "inc" instruction.
+   */
+  void incrementVariable() {
+    if (args.size() != 3) { /* invalid argument number */
+      std::cerr << "inc: please provide one valid argument\n";
+    }
+    else {
+      // check variable exists
+      std::string key(args[1]);
+      Decimal * value = vars.number(key);
+      if (value == nullptr) { /* not exist, set "1" */
+        vars.set(key, "1");
       }
-      else if (curt == SIZE_MAX && !carry) {  // no carry after all digits
-        return answer;
+      else if (!value->isNumber()) { /* not a number, set "1" */
+        value->assign("1");
       }
-      else {  // no carry with remaining digits
-        answer = str.substr(0, curt - 0 + 1) + answer;
+      else { /* number, increment by 1 in place */
+        value->increment();
       }
     }
+  }
 
-    return answer;
+  /*
+    "add", "sub" and "mul" instructions, like "add i 2.5" or "mul i -3".
+    Variable not set or not a number counts as 0, like "inc" does.
+   */
+  void calculateVariable() {
+    std::string ins(args[0]);
+    if (args.size() != 4) { /* invalid argument number */
+      std::cerr << ins << ": please provide a variable and a number\n";
+      return;
+    }
+    Decimal operand((std::string(args[2])));
+    if (!operand.isNumber()) {
+      std::cerr << ins << ": " << args[2] << " is not a number\n";
+      return;
+    }
+
+    std::string key(args[1]);
+    Decimal * value = vars.number(key);
+    if (value == nullptr) {
+      vars.set(key, "0");
+      value = vars.number(key);
+    }
+
+    if (ins == "add") {
+      value->add(operand);
+    }
+    else if (ins == "sub") {
+      value->subtract(operand);
+    }
+    else {
+      value->multiply(operand);
+    }
   }
 };
 
 /*
-  Set up environment variables with a vector to store them.
+ Print shell message with current directory, format is given by PS1
 */
-std::vector<char *> setEnv(char ** envp) {
-  std::vector<char *> new_envs;
-
-  for (char ** env = envp; *env != nullptr; ++env) {
-    new_envs.push_back(*env);
+void printShell(Prompt & prompt, EnvStore & env) {
+  // no prompt when running script
+  if (!shell_options.show_prompt) {
+    return;
   }
-  new_envs.push_back(nullptr);
 
-  return new_envs;
+  // print
+  prompt.print(env);
 }
 
 /*
- Print shell message with current directory
+ Print prompt asking for next line of a block, given by PS2
 */
-void printShell() {
-  // get current directory
-  char cwd[PATH_LEN];
-  if (!getcwd(cwd, PATH_LEN)) {
-    std::cerr << "getcwd() error" << std::endl;
-    exit(EXIT_FAILURE);
+void printContinuation(Prompt & prompt) {
+  if (!shell_options.show_prompt) {
+    return;
   }
-
-  // print
-  std::cout << "myShell$:" << cwd << " $ ";
+  prompt.printContinuation();
 }
 
 /* 
  Determine whether input is exit
  */
-bool isExit(std::string input) {
+bool isExit(const std::string & input) {
   // corner case: exit with space around - still exit
   // corner case: e\x\i\t - should not exit
-  char * command = nullptr;
-  command = std::strtok(&input[0], " ");
-  std::string compare(command);
-
-  if (compare == "exit") {
-    return true;
-  }
-  else {
+  size_t start = input.find_first_not_of(" ");
+  if (start == std::string::npos) {
     return false;
   }
+  size_t end = input.find(" ", start);
+  if (end == std::string::npos) {
+    end = input.size();
+  }
+
+  return input.compare(start, end - start, "exit") == 0;
 }
 
 /*                                                                                   
  Determine whether input is space or empty
 */
-bool isSpace(std::string input) {
+bool isSpace(const std::string & input) {
   // loop for all characters, any nonspace found return false
   for (size_t i = 0; i < input.size(); i++) {
     if (input[i] != ' ')
@@ -630,245 +920,267 @@ bool isSpace(std::string input) {
 }
 
 /*
-  Function to help determine a character in specific range for $variable
+  Decide whether built-in instructions or not
 */
-bool determineRange(char c) {
-  if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')
-    return true;
-  else
+bool isBuiltIn(const char * name) {
+  // command without any word
+  if (name == nullptr) {
     return false;
+  }
+
+  // one lookup in BUILTIN, no matter how many instructions there are
+  return BUILTIN.find(name) != BUILTIN.end();
 }
 
 /*
-  Function to get $var with its corresponding value.
+  Decide whether a built-in utility like echo, which is reported like a program and can also
+  be run as a program.
 */
-std::string pruneForVariable(std::string input,
-                             std::unordered_map<std::string, std::string> & vars) {
-  std::string answer;
-  for (size_t i = 0; i < input.size(); i++) {
-    if (input[i] != '$') {
-      answer += input[i];
-    }
-    else {
-      // something like DFS to find longedt possible match for variable name
-      size_t start = i + 1;       // position right after '$'
-      size_t curt = i + 1;        // position we currently looking
-      size_t match_position = i;  // last match position
-      std::string temp;           // current longest match
-
-      // DFS to search longest match and update i
-      while (curt <= input.size() && determineRange(input[curt])) { /* curt is valid */
-        std::string curtcut = input.substr(start, curt - start + 1);
-
-        if (vars.find(curtcut) != vars.end()) { /* substring from start to curt is valid */
-          temp = vars[curtcut];
-          match_position = curt;
-        }
-        curt++;
-      }
-
-      // update answer and match position to know where to continue after this match
-      answer += temp;
-      i = match_position;
-    }
+bool isUtility(const char * name) {
+  if (name == nullptr) {
+    return false;
   }
-  return answer;
+  std::unordered_map<std::string, BuiltinKind>::const_iterator it = BUILTIN.find(name);
+  return it != BUILTIN.end() && it->second >= BUILTIN_ECHO;
 }
 
-/* 
-  Prune input in 2 steps:
-  1. detect $ in input
-  2. detect '\' in args after command, deliminate if chracter next to it is not space
+/*
+  Decide whether a built-in instruction writes only through std::cout, so what it prints can be
+  captured in the shell itself. fg, bg, wait and parallel run programs that write themselves.
 */
-std::string pruneInput(std::string input, std::unordered_map<std::string, std::string> & vars) {
-  /* Step1: prune for $ variables */
-  input = pruneForVariable(input, vars);
-
-  /* Step2: prune for '/' in args after command */
-  std::string answer;
-
-  // sorry for my naive approach..
-  // first_space mark the status of if currently on the left space of command
-  // second_space mark the status of if currently on the right space of command
-  /* for example "  ls  -a"
-     first_space detect space on the left of "ls"
-     second_space detect space between "ls" and "-a"
-   */
-  bool first_space = true;
-  bool second_space = true;
-
-  /* 
-     Using those two space flags to detect if we are on the right of our command.
-     When both of them are false, we are on the right of command.
-     This is where we should ignore all '/'.
-   */
-  for (size_t i = 0; i < input.size(); i++) {
-    if (first_space && second_space) { /* on the left of command or already pass it */
-      if (input[i] != ' ') {           /* found first nonspace character */
-        first_space = false;
-        if (input[i] != '\\')  // ignore '\\'
-          answer += input[i];
-      }
-    }
-    else if (second_space) { /* on command itself or just after it */
-      if (input[i] == ' ') { /* just after command, first space after command */
-        second_space = false;
-      }
-      if (input[i] != '\\')  // ignore '\\'
-        answer += input[i];
-    }
-    else { /* passed commands, handle '\\' */
-      if (input[i] != '\\') {
-        answer += input[i];
-      }
-      else {                                                // '\\'
-        if (i + 1 < input.size() && input[i + 1] == ' ') {  // space after it, keep them both
-          answer += input[i];
-          answer += input[i + 1];
-          i++;
-        }
-      }
-    }
+bool printsOnly(const char * name) {
+  if (name == nullptr) {
+    return false;
   }
-
-  return answer;
+  std::unordered_map<std::string, BuiltinKind>::const_iterator it = BUILTIN.find(name);
+  return it != BUILTIN.end() && it->second != BUILTIN_FG && it->second != BUILTIN_BG &&
+         it->second != BUILTIN_WAIT && it->second != BUILTIN_PARALLEL;
 }
 
 /*
-  Decide whether built-in instructions or not
+  Handle built-in instructions, return how it terminated like status from wait().
 */
-bool isBuiltIn(std::string input) {
-  // get the first word from command
-  std::string first = input2Args(input)[0];
-
-  // traverse BUILTIN, any instruction match return true
-  for (size_t i = 0; i < BUILTIN.size(); i++) {
-    if (BUILTIN[i] == first)
-      return true;
-  }
-  return false;
+int handleBuiltIn(EnvStore & env,
+                  const LexedCommand & command,
+                  VarTable & vars,
+                  CommandCache & cache,
+                  JobTable & jobs,
+                  Prompt & prompt) {
+  TraceScope scope(tracer, "builtin", command.args[0]);
+  MyBuiltInIns new_ins(env, command, vars, cache, jobs, prompt);
+  return W_EXITCODE(new_ins.run(), 0);
 }
 
 /*
-  Convert input string to vector arguments
-  Version: for isBuiltIn.
+  Print how a program terminated.
 */
-std::vector<char *> input2Args(std::string & input) {
-  std::vector<char *> args;
-
-  // delimiter = " ", cut original string into pieces
-  char * p = std::strtok(&input[0], " ");
-  while (p != nullptr) {
-    args.push_back(p);
-    p = std::strtok(nullptr, " ");
+void reportStatus(int wstatus) {
+  if (!shell_options.report_status) {
+    return;
   }
-  p = nullptr;
-  args.push_back(p);
 
-  return args;
+  if (WIFSIGNALED(wstatus)) {
+    reportOutput() << "Program was killed by signal " << WTERMSIG(wstatus) << std::endl;
+  }
+  else if (WIFEXITED(wstatus)) {
+    reportOutput() << "Program exited with status " << WEXITSTATUS(wstatus) << std::endl;
+  }
 }
 
 /*
-  Convert input string to vector arguments.
-  Version: for class constructor.
+  Print how every stage of a pipeline terminated in one line, or one program like before.
 */
-std::vector<char *> input2Args(std::string & input, std::string & modified) {
-  std::vector<char *> args;  // stores pointer to string for variables
+void reportStatuses(std::vector<int> & statuses) {
+  if (statuses.size() == 1) {
+    reportStatus(statuses[0]);
+    return;
+  }
+  if (!shell_options.report_status) {
+    return;
+  }
 
-  size_t end = modified.size() -
-               1;       // mark end of modified input, because size will shink when encoutering '\ '
-  bool inword = false;  // mark if it's currently a word
-  for (size_t i = 0, j = 0; i < input.size(); i++) {
-    if (input[i] != ' ' && inword == false) {  // just at the first character of the word
-      if (input[i] != '\\') {                  // no encounter '\'
-        modified[j] = input[i];
-      }
-      else {  // encouter '\'
-        modified[j] = ' ';
-        i++;
-        modified[end] = 0;  // help for decrease size
-        end--;              // decrease size because '\ ' becomes ' '
-      }
-      inword = true;                 // mark we encounter word
-      args.push_back(&modified[j]);  // store word position
-      j++;
+  std::ostream & out = reportOutput();
+  out << "Pipeline exited with status ";
+  for (size_t i = 0; i < statuses.size(); i++) {
+    if (i > 0) {
+      out << " | ";
     }
-    else if (input[i] != ' ' && inword == true) {  // at middle of word
-      if (input[i] != '\\') {                      // not encounter '\'
-        modified[j] = input[i];
-      }
-      else {  // encounter '\'
-        modified[j] = ' ';
-        i++;
-        modified[end] = 0;
-        end--;
-      }
-      j++;
+    if (WIFSIGNALED(statuses[i])) {
+      out << "killed by signal " << WTERMSIG(statuses[i]);
     }
-    else if (input[i] == ' ') {  // at space, no matter what set it to '\0'
-      input[i] = 0;
-      modified[j] = 0;
-      j++;
-      inword = false;
+    else {
+      out << WEXITSTATUS(statuses[i]);
     }
   }
-
-  // remember to add nullptr
-  args.push_back(nullptr);
-
-  return args;
+  out << std::endl;
 }
 
 /*
-  Handle built-in instructions
+  Find "time" at the start of input, remove it and return true if there's one.
 */
-void handleBuiltIn(std::vector<char *> & envs,
-                   char * env_path,
-                   std::string input,
-                   std::unordered_map<std::string, std::string> & vars) {
-  MyBuiltInIns new_ins(envs, env_path, input, vars);
-  new_ins.execute();
+bool takeTime(std::string & input) {
+  size_t start = input.find_first_not_of(" ");
+  if (start == std::string::npos || input.compare(start, 4, "time") != 0 ||
+      (start + 4 < input.size() && input[start + 4] != ' ')) {
+    return false;
+  }
+  input.erase(0, start + 4);
+  return true;
 }
 
 /*
-  Handle process according to child and parent
+  Find '&' at the end of input, remove it and return true if there's one.
 */
-void handleProcess(pid_t pid, std::vector<char *> & envs, char * env_path, std::string input) {
-  // child process error
-  if (pid == -1) {
-    std::cerr << "fork";
-    exit(EXIT_FAILURE);
+bool takeBackground(std::string & input) {
+  size_t last = input.find_last_not_of(" ");
+  if (last == std::string::npos || input[last] != '&' || (last > 0 && input[last - 1] == '\\')) {
+    return false;
   }
+  input.erase(last);
+  return true;
+}
 
-  if (pid == 0) { /* code excuted by child */
-    // generate new MyCommand object and execute corresponding command
-    MyCommand new_command(envs, env_path, input);
-    new_command.execute();
+/*
+  Handle job, a single command or pipeline like "cmd1 | cmd2 | cmd3", stages are already lexed.
+  All stages run at the same time connected by pipes, data never passes through the shell.
+  Return how the last stage terminated, or 0 if job runs in background.
+  Resources it used are printed when it finishes if it's timed.
+*/
+int handlePipeline(EnvStore & env,
+                   std::vector<LexedCommand> & stages,
+                   VarTable & vars,
+                   CommandCache & cache,
+                   JobTable & jobs,
+                   Prompt & prompt,
+                   bool background,
+                   bool timed,
+                   const std::string & command) {
+  // every stage must have a command
+  for (size_t i = 0; i < stages.size(); i++) {
+    if (stages[i].blank) {
+      std::cerr << "syntax error near unexpected token `" << (background ? "&" : "|") << "'\n";
+      return W_EXITCODE(2, 0);
+    }
   }
-  else { /* code executed by parent */
-    pid_t w;
-    int wstatus;
-    do {
-      // parent process waits for child's state change
-      w = waitpid(pid, &wstatus, WUNTRACED | WCONTINUED);
 
-      // error happened
-      if (w == -1) {
-        std::cerr << "waitpid";
-        exit(EXIT_FAILURE);
-      }
+  std::vector<pid_t> pids(stages.size(), -1);   // pid of each stage, -1 if not started
+  std::vector<int> statuses(stages.size(), 0);  // how each stage terminated
+  int prev_read = -1;                           // read end of pipe from previous stage
+  pid_t pgid = jobs.jobControl() ? 0 : -1;      // whole job shares one process group
+  double started_at = monotonicSeconds();       // real time of job counts from first start
+
+  for (size_t i = 0; i < stages.size(); i++) {
+    // pipe to next stage, close-on-exec so only the stages using it keep it open
+    int fds[2] = {-1, -1};
+    if (i + 1 < stages.size() && pipe2(fds, O_CLOEXEC) == -1) {
+      std::cerr << "pipe: " << std::strerror(errno) << std::endl;
+      break;
+    }
 
-      // different termination
-      if (WIFSIGNALED(wstatus)) {
-        std::cout << "Program was killed by signal " << WTERMSIG(wstatus) << std::endl;
+    LaunchSpec spec;
+    spec.pgid = pgid;
+    spec.foreground = pgid != -1 && !background;
+    if (prev_read != -1) {
+      spec.actions.push_back(FdAction(STDIN_FILENO, prev_read));
+    }
+    else if (background && !jobs.jobControl()) { /* without job control nobody may read terminal */
+      spec.actions.push_back(FdAction(STDIN_FILENO, "/dev/null", O_RDONLY));
+    }
+    if (fds[1] != -1) {
+      spec.actions.push_back(FdAction(STDOUT_FILENO, fds[1]));
+    }
+
+    if (isBuiltIn(stages[i].args[0])) { /* built-in instruction runs in a forked copy of shell */
+      std::cout.flush();
+      TraceScope scope(tracer, "fork", stages[i].args[0]);
+      pids[i] = fork();
+      if (pids[i] == 0) {
+        prepareChild(pgid, spec.foreground);
+        if (!applyFdActions(spec.actions)) {
+          _exit(EXIT_FAILURE);
+        }
+        int wstatus = handleBuiltIn(env, stages[i], vars, cache, jobs, prompt);
+        std::cout.flush();
+        _exit(WEXITSTATUS(wstatus));
+      }
+      if (pids[i] == -1) {
+        std::cerr << "fork: " << std::strerror(errno) << std::endl;
+        statuses[i] = W_EXITCODE(EXIT_FAILURE, 0);
       }
-      else if (WIFEXITED(wstatus)) {
-        std::cout << "Program exited with status " << WEXITSTATUS(wstatus) << std::endl;
+      else if (pgid != -1) {
+        setpgid(pids[i], pgid == 0 ? pids[i] : pgid);
+      }
+    }
+    else { /* real command */
+      MyCommand new_command(env, stages[i], cache);
+      pids[i] = new_command.launch(spec, shell_options.launch_mode, statuses[i]);
+    }
+
+    // first process started leads the process group, a foreground job gets terminal right away
+    if (pgid == 0 && pids[i] != -1) {
+      pgid = pids[i];
+      if (spec.foreground) {
+        tcsetpgrp(STDIN_FILENO, pgid);
       }
-    } while (!WIFEXITED(wstatus) &&
-             !WIFSIGNALED(
-                 wstatus)); /* exit unnormally && no signal raised to cause exit, then loop again */
+    }
+
+    // parent keeps no pipe ends, otherwise readers never see end of file
+    if (prev_read != -1) {
+      close(prev_read);
+    }
+    if (fds[1] != -1) {
+      close(fds[1]);
+    }
+    prev_read = fds[0];
+  }
+  if (prev_read != -1) {
+    close(prev_read);
+  }
+
+  // record started processes as one job, stages not started have only a status record
+  std::vector<pid_t> started;
+  for (size_t i = 0; i < pids.size(); i++) {
+    if (pids[i] != -1) {
+      started.push_back(pids[i]);
+    }
+    else if (status_stream.on()) {
+      struct rusage none;
+      std::memset(&none, 0, sizeof(none));
+      status_stream.add(0, -1, stages[i].args[0], statuses[i], started_at, 0, none);
+    }
+  }
+  if (started.empty()) { /* nothing started, report as if child failed */
+    reportStatuses(statuses);
+    return statuses.back();
+  }
+  Job & job = jobs.add(pgid > 0 ? pgid : 0, command, started, background, timed);
+  job.started = started_at;
+  for (size_t i = 0, j = 0; i < pids.size(); i++) {
+    if (pids[i] != -1) {
+      job.procs[j++].name = stages[i].args[0];
+    }
+  }
+
+  if (background) {
+    if (shell_options.report_status) {
+      reportOutput() << "[" << job.id << "] " << started.back() << std::endl;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  // wait for every stage, they all run at the same time
+  TraceScope scope(tracer, "wait", command.c_str());
+  if (!jobs.waitForeground(job)) { /* stopped, it's in background now */
+    return W_EXITCODE(128 + SIGTSTP, 0);
+  }
+  for (size_t i = 0, j = 0; i < pids.size(); i++) {
+    if (pids[i] != -1) {
+      statuses[i] = job.procs[j++].status;
+    }
   }
+  jobs.remove(job);
 
-  printShell();
+  // report all stages in one line
+  reportStatuses(statuses);
+  return statuses.back();
 }